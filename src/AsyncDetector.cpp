@@ -0,0 +1,152 @@
+#include "AsyncDetector.h"
+#include "GrowArray.h"
+#include "Profiling.h"
+
+AsyncDetector::AsyncDetector(){
+	occupiedRadius = 0.f;
+	window = cvSize(0, 0);
+	levels = 0;
+	running = false;
+	stopping = false;
+	busy = false;
+	ready = false;
+	failed = false;
+	allocations = 0;
+	workerAllocations = 0;
+	workerError[0] = 0;
+	error[0] = 0;
+}
+
+AsyncDetector::~AsyncDetector(){
+	stop();
+}
+
+void AsyncDetector::stop(){
+	if(!running)return;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_one();
+	worker.join();
+	running = false;
+	busy = false;
+	ready = false;
+	failed = false;
+}
+
+bool AsyncDetector::isIdle(){
+	std::lock_guard<std::mutex> lock(mutex);
+	return !busy && !ready;
+}
+
+char AsyncDetector::submit(CvMat *image, const FeatureDetector &settings, const CvPoint2D32f *points, const char *status,
+	unsigned int n, float radius, CvSize w, int l){
+	if((!image)||(CV_MAT_TYPE(image->type) != CV_8UC1)){
+		strcpy_s(error, 255, "AsyncDetector::submit failed: input must be 8-bit, 1 plane");
+		return 0;
+	}
+	if(!running){
+		stopping = false;
+		try{
+			worker = std::thread(&AsyncDetector::run, this);
+		}
+		catch(std::exception &e){
+			strcpy_s(error, 255, e.what());
+			return 0;
+		}
+		running = true;
+	}
+	
+	{
+		//The worker does not touch any of this while idle
+		std::lock_guard<std::mutex> lock(mutex);
+		if(busy || ready)return 1;
+		try{
+			const uchar *storage = frame.datastart;
+			frame.create(image->rows, image->cols, CV_8UC1);
+			if(frame.datastart != storage)allocations++;
+		}
+		catch(cv::Exception &e){
+			strcpy_s(error, 255, e.what());
+			return 0;
+		}
+		for(int y=0;y<image->rows;y++)memcpy(frame.ptr<uchar>(y), image->data.ptr + y*image->step, image->cols);
+		
+		if(occupied.capacity() < n){
+			occupied.reserve(growCapacity((unsigned int)occupied.capacity(), n));
+			allocations++;
+		}
+		occupied.clear();
+		for(unsigned int i=0;i<n;i++)if(!status || status[i])occupied.push_back(points[i]);
+		occupiedRadius = radius;
+		context = TraceRecorder::getContext();
+		detector.copySettings(settings);
+		window = w;
+		levels = l;
+		failed = false;
+		busy = true;
+	}
+	wake.notify_one();
+	return 1;
+}
+
+bool AsyncDetector::hasFailed(){
+	std::lock_guard<std::mutex> lock(mutex);
+	if(failed)strcpy_s(error, 255, workerError);
+	return failed;
+}
+
+unsigned int AsyncDetector::getAllocationCount(){
+	std::lock_guard<std::mutex> lock(mutex);
+	return allocations + workerAllocations;
+}
+
+char AsyncDetector::collect(const CvPoint2D32f **features, unsigned int *count, const ImagePyramid **pyramid){
+	std::lock_guard<std::mutex> lock(mutex);
+	if(!ready)return 0;
+	*features = detector.getFeaturePtr();
+	*count = detector.getCount();
+	*pyramid = &snapshot;
+	return 1;
+}
+
+void AsyncDetector::release(){
+	std::lock_guard<std::mutex> lock(mutex);
+	ready = false;
+}
+
+void AsyncDetector::discard(){
+	std::unique_lock<std::mutex> lock(mutex);
+	if(running)wake.wait(lock, [this]{return !busy;});
+	ready = false;
+	failed = false;
+}
+
+void AsyncDetector::run(){
+	CVFLOW_THREAD_NAME("cv.jit.flow detector");
+	std::unique_lock<std::mutex> lock(mutex);
+	while(true){
+		wake.wait(lock, [this]{return stopping || busy;});
+		if(stopping)break;
+		lock.unlock();
+		
+		CVFLOW_FRAME_CONTEXT(context);
+		CVFLOW_TASK("asyncDetect");
+		CvMat image = frame;
+		char ok = snapshot.build(&image, window, levels);
+		if(ok){
+			detector.setOccupied(occupied.empty() ? 0 : &occupied[0], 0, (unsigned int)occupied.size(), occupiedRadius);
+			ok = detector.findFeatures(snapshot.getImage());
+		}
+		
+		lock.lock();
+		if(!ok)strcpy_s(workerError, 255, snapshot.isValid() ? detector.getErrorMess() : snapshot.getErrorMess());
+		workerAllocations = detector.getAllocationCount() + snapshot.getAllocationCount();
+		busy = false;
+		ready = ok != 0;
+		failed = !ok;
+		//discard() may be waiting for this detection
+		wake.notify_all();
+	}
+}
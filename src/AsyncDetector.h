@@ -0,0 +1,76 @@
+#ifndef _ASYNCDETECTOR_H_
+#define _ASYNCDETECTOR_H_
+
+#include "FeatureDetector.h"
+#include "ImagePyramid.h"
+#include "TraceRecorder.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+using namespace std;
+
+/*Feature detection on a worker thread. submit() copies a frame, the
+  points already tracked in it and the detector settings, and returns
+  immediately. The worker builds a pyramid of its copy (the snapshot) and
+  detects features in it. Once the results are collected, the snapshot
+  lets the caller track the features forward to its own latest frame.
+  Only one detection is in flight at a time.*/
+class AsyncDetector{
+	private:
+		FeatureDetector detector;
+		ImagePyramid snapshot;
+		cv::Mat frame;
+		vector<CvPoint2D32f> occupied;
+		float occupiedRadius;
+		TraceContext context;	//Of the frame the job was submitted with
+		CvSize window;
+		int levels;
+		std::thread worker;
+		std::mutex mutex;
+		std::condition_variable wake;
+		bool running;
+		bool stopping;
+		bool busy;		//A detection is in flight
+		bool ready;		//Results are waiting to be collected
+		bool failed;
+		unsigned int allocations;		//Of the calling thread's buffers
+		unsigned int workerAllocations;	//Detector and snapshot, as of the last job
+		char workerError[256];	//Set by the worker, copied to error by hasFailed()
+		char error[256];		//Only written by the calling thread
+
+		void run();
+
+	public:
+		AsyncDetector();
+		~AsyncDetector();
+
+		void stop();
+		bool isRunning(){return running;}
+
+		/*Starts a detection on a copy of image, with the settings of
+		  settings and skipping points within radius of tracked points.
+		  The snapshot is built for window and levels. Returns 1 without
+		  doing anything if a detection is in flight or uncollected.*/
+		char submit(CvMat *image, const FeatureDetector &settings, const CvPoint2D32f *points, const char *status,
+			unsigned int n, float radius, CvSize window, int levels);
+		bool isIdle();
+
+		/*Returns 1 and the detected features if a detection finished, 0
+		  otherwise. The features and snapshot stay valid until release().*/
+		char collect(const CvPoint2D32f **features, unsigned int *count, const ImagePyramid **pyramid);
+		void release();
+		//Waits for the detection in flight and drops any results or failure
+		void discard();
+
+		//True if the last detection failed, with its message in getErrorMess().
+		//The failure stands until discard() or stop().
+		bool hasFailed();
+		unsigned int getAllocationCount();
+
+		const char* getErrorMess(){return error;}
+};
+
+#endif
@@ -0,0 +1,303 @@
+#include "AsyncTracker.h"
+#include "GrowArray.h"
+#include "Profiling.h"
+
+/****FlowSettings****/
+
+void FlowSettings::apply(OpticalFlowTracker &tracker) const{
+	tracker.setDetectorThreshold(threshold);
+	tracker.setMinDistance(minDistance);
+	tracker.setWindowSize(radius);
+	tracker.setFeatureDetector(detector);
+	tracker.setUseOccupancy(occupancy);
+	tracker.setDetectionInterval(interval);
+	tracker.setThreads(threads);
+	tracker.setTiles(tileCols, tileRows);
+	tracker.setPrediction(predict);
+	tracker.setGlobalMotion(globalMotion);
+	tracker.setForwardBackward(fbCheck);
+	tracker.setForwardBackwardThreshold(fbThreshold);
+	tracker.setBudget(budget);
+	tracker.setAsyncDetection(asyncDetection);
+	tracker.setTelemetry(telemetry);
+	tracker.setMaxAge(3);
+}
+
+/****FlowResult****/
+
+FlowResult::FlowResult(){
+	data = 0;
+	count = 0;
+	planes = 7;
+	capacity = 0;
+}
+
+FlowResult::~FlowResult(){
+	free(data);
+}
+
+char FlowResult::pack(OpticalFlowTracker &tracker, int p){
+	CVFLOW_TASK("pack");
+	unsigned int n = tracker.getGoodVectorCount();
+	planes = p > 7 ? 8 : 7;
+	count = 0;
+	if(n * planes > capacity){
+		unsigned int c = growCapacity(capacity, n * planes);
+		if(!growArray(&data, c))return 0;
+		capacity = c;
+	}
+	count = write(tracker, planes, data, n);
+	return 1;
+}
+
+unsigned int FlowResult::write(OpticalFlowTracker &tracker, int planes, float *out, unsigned int n){
+	const FlowVectors &v = tracker.getVectors();
+	unsigned int i, count = 0, total = tracker.getVectorCount();
+	for(i=0;(i<total)&&(count<n);i++){
+		if(!tracker.isGoodVector(i))continue;
+		out[0] = v.x[i];
+		out[1] = v.y[i];
+		out[2] = v.x2[i];
+		out[3] = v.y2[i];
+		out[4] = v.alpha[i];
+		out[5] = v.theta[i];
+		out[6] = (float)v.index[i];
+		if(planes > 7)out[7] = v.fbError[i];
+		out += planes;
+		count++;
+	}
+	return count;
+}
+
+void FlowResult::swap(FlowResult &r){
+	float *d = data; data = r.data; r.data = d;
+	unsigned int t;
+	CV_SWAP(count, r.count, t);
+	CV_SWAP(planes, r.planes, t);
+	CV_SWAP(capacity, r.capacity, t);
+}
+
+char FlowResult::copy(const FlowResult &r){
+	if(r.count * r.planes > capacity){
+		unsigned int c = growCapacity(capacity, r.count * r.planes);
+		if(!growArray(&data, c))return 0;
+		capacity = c;
+	}
+	if(r.count)memcpy(data, r.data, r.count * r.planes * sizeof(float));
+	count = r.count;
+	planes = r.planes;
+	return 1;
+}
+
+/****AsyncTracker****/
+
+AsyncTracker::AsyncTracker(OpticalFlowTracker *t){
+	tracker = t;
+	running = false;
+	stopping = false;
+	pending = false;
+	resetPending = false;
+	statsResetPending = false;
+	failed = false;
+	busy = false;
+	telemetryClosePending = false;
+	pendingContext.instance = 0;
+	pendingContext.frame = 0;
+	completed = 0;
+	dropped = 0;
+	workerError[0] = 0;
+	error[0] = 0;
+}
+
+AsyncTracker::~AsyncTracker(){
+	stop();
+}
+
+char AsyncTracker::start(){
+	if(running)return 1;
+	if(!tracker){strcpy_s(error, 255, "AsyncTracker::start failed"); return 0;}
+	stopping = false;
+	pending = false;
+	failed = false;
+	busy = false;
+	telemetryClosePending = false;
+	latest.count = 0;
+	try{
+		worker = std::thread(&AsyncTracker::run, this);
+	}
+	catch(std::exception &e){
+		strcpy_s(error, 255, e.what());
+		return 0;
+	}
+	running = true;
+	return 1;
+}
+
+//Waits for the frame in progress; a pending frame is dropped
+void AsyncTracker::stop(){
+	if(!running)return;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_one();
+	worker.join();
+	running = false;
+	if(resetPending){
+		tracker->reset();
+		resetPending = false;
+	}
+	if(statsResetPending){
+		tracker->resetStats();
+		statsResetPending = false;
+	}
+}
+
+char AsyncTracker::submit(CvMat *image, const FlowSettings &settings){
+	if((!image)||(CV_MAT_TYPE(image->type) != CV_8UC1)){
+		strcpy_s(error, 255, "AsyncTracker::submit failed: input must be 8-bit, 1 plane");
+		return 0;
+	}
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		try{
+			pendingFrame.create(image->rows, image->cols, CV_8UC1);
+		}
+		catch(cv::Exception &e){
+			strcpy_s(error, 255, e.what());
+			return 0;
+		}
+		for(int y=0;y<image->rows;y++)memcpy(pendingFrame.ptr<uchar>(y), image->data.ptr + y*image->step, image->cols);
+		if(pending)dropped++;
+		pendingSettings = settings;
+		pendingContext = TraceRecorder::getContext();
+		pending = true;
+	}
+	wake.notify_one();
+	return 1;
+}
+
+char AsyncTracker::getResult(FlowResult &result){
+	std::lock_guard<std::mutex> lock(mutex);
+	//A failed frame is reported once, like processFrame, and the worker
+	//carries on with the next one
+	if(failed){
+		strcpy_s(error, 255, workerError);
+		failed = false;
+		return 0;
+	}
+	if(!result.copy(latest)){strcpy_s(error, 255, "AsyncTracker::getResult failed"); return 0;}
+	return 1;
+}
+
+void AsyncTracker::wait(){
+	if(!running)return;
+	std::unique_lock<std::mutex> lock(mutex);
+	done.wait(lock, [this]{return !pending && !busy;});
+}
+
+unsigned int AsyncTracker::getCompletedCount(){
+	std::lock_guard<std::mutex> lock(mutex);
+	return completed;
+}
+
+unsigned int AsyncTracker::getDroppedCount(){
+	std::lock_guard<std::mutex> lock(mutex);
+	return dropped;
+}
+
+void AsyncTracker::getStats(FlowStats &s){
+	if(!running){
+		s = tracker->getStats();
+		return;
+	}
+	std::lock_guard<std::mutex> lock(mutex);
+	s = stats;
+}
+
+void AsyncTracker::resetStats(){
+	if(!running){
+		tracker->resetStats();
+		return;
+	}
+	std::lock_guard<std::mutex> lock(mutex);
+	statsResetPending = true;
+	stats.reset();
+}
+
+void AsyncTracker::reset(){
+	if(!running){
+		tracker->reset();
+		return;
+	}
+	std::lock_guard<std::mutex> lock(mutex);
+	resetPending = true;
+	failed = false;
+	latest.count = 0;
+}
+
+void AsyncTracker::closeTelemetry(){
+	if(!running){
+		tracker->setTelemetry(false);
+		return;
+	}
+	std::lock_guard<std::mutex> lock(mutex);
+	pendingSettings.telemetry = false;
+	//The worker only uses the tracker while busy
+	if(busy)telemetryClosePending = true;
+	else tracker->setTelemetry(false);
+}
+
+void AsyncTracker::run(){
+	CVFLOW_THREAD_NAME("cv.jit.flow tracker");
+	std::unique_lock<std::mutex> lock(mutex);
+	while(true){
+		wake.wait(lock, [this]{return stopping || pending;});
+		if(stopping)break;
+		
+		//Take the pending frame and its settings, leaving the other buffer
+		//for the next submit()
+		cv::Mat tmp = workFrame;
+		workFrame = pendingFrame;
+		pendingFrame = tmp;
+		FlowSettings settings = pendingSettings;
+		TraceContext context = pendingContext;
+		bool restart = resetPending;
+		bool restartStats = statsResetPending;
+		statsResetPending = false;
+		pending = false;
+		resetPending = false;
+		busy = true;
+		lock.unlock();
+		
+		//Trace the frame under the submitter's frame number
+		CVFLOW_FRAME_CONTEXT(context);
+		if(restart)tracker->reset();
+		if(restartStats)tracker->resetStats();
+		settings.apply(*tracker);
+		CvMat image = workFrame;
+		char ok = tracker->processFrame(&image);
+		char packed = ok && workResult.pack(*tracker, settings.planes);
+		
+		lock.lock();
+		if(!ok){
+			strcpy_s(workerError, 255, tracker->getErrorMess());
+			failed = true;
+		}
+		else if(!packed){
+			strcpy_s(workerError, 255, "AsyncTracker failed: result");
+			failed = true;
+		}
+		else{
+			latest.swap(workResult);
+			stats = tracker->getStats();
+			completed++;
+		}
+		if(telemetryClosePending){
+			tracker->setTelemetry(false);
+			telemetryClosePending = false;
+		}
+		busy = false;
+		if(!pending)done.notify_all();
+	}
+}
@@ -0,0 +1,118 @@
+#ifndef _ASYNCTRACKER_H_
+#define _ASYNCTRACKER_H_
+
+#include "OpticalFlowTracker.h"
+#include "TraceRecorder.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/*Everything cv.jit.flow sets on the tracker before a frame, so that a
+  whole set of attribute values can travel with the frame it applies to.*/
+struct FlowSettings{
+	float threshold;
+	float minDistance;
+	int radius;
+	int detector;
+	bool occupancy;
+	unsigned int interval;
+	int threads;
+	int tileCols;
+	int tileRows;
+	bool predict;
+	bool globalMotion;
+	bool fbCheck;
+	float fbThreshold;
+	bool asyncDetection;
+	float budget;
+	bool telemetry;
+	int planes;		//7, or 8 to include the forward-backward error
+
+	void apply(OpticalFlowTracker &tracker) const;
+};
+
+/*Good vectors of one frame, packed as cv.jit.flow outputs them: planes
+  floats per vector. The buffer only grows.*/
+class FlowResult{
+	public:
+		float *data;
+		unsigned int count;
+		unsigned int planes;
+		unsigned int capacity;
+
+		FlowResult();
+		~FlowResult();
+
+		char pack(OpticalFlowTracker &tracker, int planes);
+		//Writes up to n good vectors of the tracker to out, returns how many
+		static unsigned int write(OpticalFlowTracker &tracker, int planes, float *out, unsigned int n);
+		char copy(const FlowResult &r);
+		void swap(FlowResult &r);
+};
+
+/*Runs a tracker on a worker thread, one frame behind. submit() copies the
+  frame and its settings into a pending slot and returns immediately; the
+  worker picks up the latest pending frame, applies its settings, processes
+  it and publishes the result. A frame still pending when the next one
+  arrives is dropped. The tracker must not be used directly while the
+  worker is running.*/
+class AsyncTracker{
+	private:
+		OpticalFlowTracker *tracker;
+		std::thread worker;
+		std::mutex mutex;
+		std::condition_variable wake;
+		std::condition_variable done;	//Signalled when the worker goes idle
+		bool running;
+		bool stopping;
+		bool pending;
+		bool resetPending;
+		bool statsResetPending;
+		bool failed;			//A frame failed and getResult() has not reported it yet
+		bool busy;				//The worker is processing a frame
+		bool telemetryClosePending;
+		cv::Mat pendingFrame;	//Double buffer: filled by submit()...
+		cv::Mat workFrame;		//...and swapped in by the worker
+		FlowSettings pendingSettings;
+		TraceContext pendingContext;	//Of the thread that submitted the frame
+		FlowResult workResult;
+		FlowResult latest;
+		FlowStats stats;		//Tracker stats as of the latest result
+		unsigned int completed;
+		unsigned int dropped;
+		char workerError[256];	//Set by the worker, copied to error on failure
+		char error[256];		//Only written by the calling thread
+
+		void run();
+
+	public:
+		AsyncTracker(OpticalFlowTracker *t);
+		~AsyncTracker();
+
+		char start();
+		void stop();
+		bool isRunning(){return running;}
+
+		char submit(CvMat *image, const FlowSettings &settings);
+		//Copies the most recently completed result, or returns 0 once if a
+		//frame failed since the last call
+		char getResult(FlowResult &result);
+		//Copies the tracker stats as of the most recently completed result
+		void getStats(FlowStats &s);
+		//Clears the tracker stats before the next frame
+		void resetStats();
+		//Resets the tracker before the next frame
+		void reset();
+		//Removes the telemetry segment now, or once the frame in progress is done
+		void closeTelemetry();
+
+		//Blocks until the worker has processed every submitted frame
+		void wait();
+		unsigned int getCompletedCount();
+		unsigned int getDroppedCount();
+
+		const char* getErrorMess(){return error;}
+};
+
+#endif
@@ -0,0 +1,85 @@
+#include "BudgetController.h"
+
+#define BUDGET_SMOOTHING 0.3f	//Weight of the newest frame in the averages
+#define BUDGET_HEADROOM 0.85f	//Loads only fall below this fraction of the budget
+#define BUDGET_GAIN 0.5f
+#define BUDGET_PEAK_DECAY 0.97f
+#define BUDGET_MAX_STEP 0.25f
+#define BUDGET_MIN_FEATURES 32
+#define BUDGET_MIN_ITERATIONS 5
+#define BUDGET_MAX_INTERVAL 4
+
+BudgetController::BudgetController(){
+	budget = 0.f;
+	reset();
+}
+
+void BudgetController::reset(){
+	frameTime = peakTime = detectTime = trackTime = 0.f;
+	detectLoad = trackLoad = 0.f;
+	primed = false;
+}
+
+void BudgetController::update(float detect, float track, float total){
+	if(!primed){
+		detectTime = detect;
+		trackTime = track;
+		frameTime = total;
+		peakTime = total;
+		primed = true;
+	}
+	else{
+		detectTime += BUDGET_SMOOTHING * (detect - detectTime);
+		trackTime += BUDGET_SMOOTHING * (track - trackTime);
+		frameTime += BUDGET_SMOOTHING * (total - frameTime);
+	}
+	if(budget <= 0.f)return;
+
+	//Frames that skip detection are cheaper, so a slowly decaying peak is
+	//compared with the budget rather than the average
+	peakTime = MAX(total, peakTime * BUDGET_PEAK_DECAY);
+	float step, rest, t = MAX(frameTime, peakTime);
+	if(t > budget){
+		//Over budget: spread the step by each stage's share of the time,
+		//anything detection cannot absorb goes to tracking
+		step = MIN(BUDGET_GAIN * (t / budget - 1.f), BUDGET_MAX_STEP);
+		float share = detectTime + trackTime > 0.f ? detectTime / (detectTime + trackTime) : 0.5f;
+		rest = step * (1.f - share);
+		detectLoad += step * share;
+		if(detectLoad > 1.f){
+			rest += detectLoad - 1.f;
+			detectLoad = 1.f;
+		}
+		trackLoad = MIN(trackLoad + rest, 1.f);
+	}
+	else if(t < budget * BUDGET_HEADROOM){
+		//Headroom: give tracking its features back before detection
+		step = MIN(BUDGET_GAIN * (1.f - t / (budget * BUDGET_HEADROOM)), BUDGET_MAX_STEP);
+		trackLoad -= step;
+		if(trackLoad < 0.f){
+			detectLoad = MAX(detectLoad + trackLoad, 0.f);
+			trackLoad = 0.f;
+		}
+	}
+}
+
+//A higher quality level keeps fewer, stronger corners
+float BudgetController::getThreshold(float base){
+	if(budget <= 0.f)return base;
+	return base + (MAX(base, 0.5f) - base) * detectLoad;
+}
+
+unsigned int BudgetController::getInterval(unsigned int base){
+	if(budget <= 0.f)return base;
+	return MAX(base, (unsigned int)cvRound(1.f + (BUDGET_MAX_INTERVAL - 1) * detectLoad));
+}
+
+unsigned int BudgetController::getMaxFeatures(unsigned int base){
+	if((budget <= 0.f)||(base <= BUDGET_MIN_FEATURES))return base;
+	return base - (unsigned int)cvRound((float)(base - BUDGET_MIN_FEATURES) * trackLoad);
+}
+
+int BudgetController::getIterations(int base){
+	if((budget <= 0.f)||(base <= BUDGET_MIN_ITERATIONS))return base;
+	return base - cvRound((float)(base - BUDGET_MIN_ITERATIONS) * trackLoad);
+}
@@ -0,0 +1,46 @@
+#ifndef _BUDGETCONTROLLER_H_
+#define _BUDGETCONTROLLER_H_
+
+#include "opencv.hpp"
+
+/*Keeps the time spent per frame under a budget by scaling down detection
+  and tracking effort from measured stage times. Each stage has a load
+  from 0 (the user's settings) to 1 (the cheapest settings). Frames over
+  budget raise detection load first, in proportion to the time detection
+  takes, since that keeps existing tracks. Frames with headroom lower
+  tracking load first, to bring back as many tracks as possible.*/
+class BudgetController{
+	private:
+		float budget;		//milliseconds, 0 when off
+		float frameTime;	//smoothed stage times, in milliseconds
+		float peakTime;
+		float detectTime;
+		float trackTime;
+		float detectLoad;
+		float trackLoad;
+		bool primed;
+
+	public:
+		BudgetController();
+		~BudgetController(){;}
+
+		void setBudget(float ms){budget = ms < 0.f ? 0.f : ms;}
+		float getBudget(){return budget;}
+		bool isActive(){return budget > 0.f;}
+
+		//Feeds the times measured for the last frame, in milliseconds
+		void update(float detect, float track, float total);
+		void reset();
+
+		float getFrameTime(){return frameTime;}
+		float getDetectLoad(){return detectLoad;}
+		float getTrackLoad(){return trackLoad;}
+
+		//Settings for the next frame, derived from the user's
+		float getThreshold(float base);
+		unsigned int getInterval(unsigned int base);
+		unsigned int getMaxFeatures(unsigned int base);
+		int getIterations(int base);
+};
+
+#endif
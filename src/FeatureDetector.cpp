@@ -1,7 +1,12 @@
 #include "FeatureDetector.h"
+#include "GrowArray.h"
+#include "Profiling.h"
+
+#include <algorithm>
 
 char FeatureDetector::adjustTempImagesSize(CvMat* image){
 	if(!tempImage){
+		allocations++;
 		tempImage = cvCreateMat(image->rows, image->cols, CV_32FC1);
 		if (!tempImage) {
 			strcpy_s(error, 256, "OpticalFlowTracker::adjustTempImagesSize failed: tempImage");
@@ -9,6 +14,7 @@ char FeatureDetector::adjustTempImagesSize(CvMat* image){
 		}
 	}
 	if(!eigImage){
+		allocations++;
 		eigImage = cvCreateMat(image->rows, image->cols, CV_32FC1);
 		if (!eigImage) {
 			strcpy_s(error, 256, "OpticalFlowTracker::adjustTempImagesSize failed: eigImage");
@@ -17,6 +23,7 @@ char FeatureDetector::adjustTempImagesSize(CvMat* image){
 	}
 	if(!CV_ARE_SIZES_EQ(tempImage, image)){
 		cvReleaseMat(&tempImage);
+		allocations++;
 		tempImage = cvCreateMat(image->rows, image->cols, CV_32FC1);
 		if (!tempImage) {
 			strcpy_s(error, 256, "OpticalFlowTracker::adjustTempImagesSize failed: tempImage 02");
@@ -25,6 +32,7 @@ char FeatureDetector::adjustTempImagesSize(CvMat* image){
 	}
 	if(!CV_ARE_SIZES_EQ(eigImage, image)){
 		cvReleaseMat(&eigImage);
+		allocations++;
 		eigImage = cvCreateMat(image->rows, image->cols, CV_32FC1);
 		if (!eigImage ){
 			strcpy_s(error, 256, "OpticalFlowTracker::adjustTempImagesSize failed: eigImage 02");
@@ -35,32 +43,335 @@ char FeatureDetector::adjustTempImagesSize(CvMat* image){
 	return 1;
 }
 
+//Both feature lists are allocated once at their maximum size and then
+//swapped from frame to frame.
+char FeatureDetector::allocateFeatures(){
+	if(!features){
+		features = (CvPoint2D32f*)malloc(MAX_EIG_FEATURE_COUNT*sizeof(CvPoint2D32f));
+		allocations++;
+	}
+	if(!previousFeatures){
+		previousFeatures = (CvPoint2D32f*)malloc(MAX_EIG_FEATURE_COUNT*sizeof(CvPoint2D32f));
+		allocations++;
+	}
+	if((!features)||(!previousFeatures)){strcpy_s(error, 255, "FeatureDetector::allocateFeatures failed"); return 0;}
+	return 1;
+}
+
+//Marks pixels close to occupied points with 0, everything else with 255.
+char FeatureDetector::buildOccupancyMask(CvMat* image){
+	if(mask && !CV_ARE_SIZES_EQ(mask, image))cvReleaseMat(&mask);
+	if(!mask){
+		allocations++;
+		mask = cvCreateMat(image->rows, image->cols, CV_8UC1);
+		if(!mask){strcpy_s(error, 255, "FeatureDetector::buildOccupancyMask failed"); return 0;}
+	}
+	cvSet(mask, cvScalarAll(255));
+	int r = cvFloor(occupiedRadius);
+	unsigned int i;
+	for(i=0;i<occupiedCount;i++){
+		if(occupiedStatus && !occupiedStatus[i])continue;
+		cvCircle(mask, cvPoint(cvRound(occupied[i].x), cvRound(occupied[i].y)), r, cvScalarAll(0), CV_FILLED);
+	}
+	return 1;
+}
+
 char FeatureDetector::findFeatures(CvMat* image){
+	CVFLOW_TASK("findFeatures");
+	char result;
+	if(!allocateFeatures())return 0;
 	//Save previous features
 	CvPoint2D32f *temp;
 	temp = features;
 	features = previousFeatures;
 	previousFeatures = temp;
 	previousCount = count;
-	switch(algorithm){
-		case(FEATURE_ALGO_FAST):
-			return findFeaturesFAST(image);
-		default:
-			return findFeaturesEigVals(image);
+	
+	if((interval > 1)&&(frameIndex++ % interval)){
+		count = 0;
+		occupiedCount = 0;
+		return 1;
 	}
+	
+	//The mask drops corners next to tracks; only FAST gets cheaper with it
+	bool masked = useOccupancy && (occupiedCount > 0) && (occupiedRadius >= 1.f);
+	if(masked && !buildOccupancyMask(image))result = 0;
+	else if(algorithm == FEATURE_ALGO_FAST)result = findFeaturesFAST(image, masked ? mask : 0);
+	else result = findFeaturesEigVals(image, masked ? mask : 0);
+	occupiedCount = 0;
+	return result;
 }
 
-char FeatureDetector::findFeaturesEigVals(CvMat* image){
+/****Shi-Tomasi****/
+
+class EigValsTileBody : public cv::ParallelLoopBody{
+	private:
+		FeatureDetector *detector;
+		CvMat *image;
+		CvMat *mask;
+		int cols;
+		int rows;
+		int quota;
+		TraceContext context;	//Of the calling thread
+	public:
+		EigValsTileBody(FeatureDetector *d, CvMat *i, CvMat *m, int c, int r, int q){
+			detector = d; image = i; mask = m; cols = c; rows = r; quota = q;
+			context = TraceRecorder::getContext();
+		}
+		void operator()(const cv::Range &range) const{
+			CVFLOW_FRAME_CONTEXT(context);
+			for(int t=range.start;t<range.end;t++)detector->findFeaturesEigValsTile(image, mask, t, cols, rows, quota);
+		}
+};
+
+//Each tile writes to its own slice of tileFeatures, so tiles can run concurrently.
+//With a mask, the tile is first shrunk to the bounding box of its uncovered
+//pixels, and skipped altogether if it is fully covered. Occupied circles are
+//scattered, so in practice the box is the whole tile and the mask only filters
+//corners after cornerMinEigenVal has run on all of it.
+void FeatureDetector::findFeaturesEigValsTile(CvMat* image, CvMat* mask, int tile, int cols, int rows, int quota){
+	CVFLOW_TASK("eigValsTile");
+	int tx = tile % cols, ty = tile / cols;
+	int x0 = image->cols * tx / cols, x1 = image->cols * (tx + 1) / cols;
+	int y0 = image->rows * ty / rows, y1 = image->rows * (ty + 1) / rows;
+	CvMat sub, eigSub, tempSub, maskSub;
+	CvPoint2D32f *out = tileFeatures + tile * quota;
+	int i, x, y, fcount = quota;
+	
+	if(mask){
+		int bx0 = x1, bx1 = x0, by0 = y1, by1 = y0;
+		for(y=y0;y<y1;y++){
+			const uchar *m = mask->data.ptr + y * mask->step;
+			for(x=x0;(x<x1)&&!m[x];x++);
+			if(x == x1)continue;
+			if(x < bx0)bx0 = x;
+			for(x=x1-1;!m[x];x--);
+			if(x >= bx1)bx1 = x + 1;
+			if(by0 == y1)by0 = y;
+			by1 = y + 1;
+		}
+		if(by0 == y1){tileCounts[tile] = 0; return;}
+		x0 = bx0; x1 = bx1; y0 = by0; y1 = by1;
+	}
+	
+	CvRect rect = cvRect(x0, y0, x1 - x0, y1 - y0);
+	cvGetSubRect(image, &sub, rect);
+	cvGetSubRect(eigImage, &eigSub, rect);
+	cvGetSubRect(tempImage, &tempSub, rect);
+	if(mask)cvGetSubRect(mask, &maskSub, rect);
+	cvGoodFeaturesToTrack(&sub, &eigSub, &tempSub, out, &fcount,
+					threshold, minDistance*(float)image->cols, mask ? &maskSub : 0, 3, 0, 0.04);
+	for(i=0;i<fcount;i++){
+		out[i].x += (float)x0;
+		out[i].y += (float)y0;
+	}
+	tileCounts[tile] = fcount;
+}
+
+char FeatureDetector::findFeaturesEigVals(CvMat* image, CvMat* mask){
 	if(!adjustTempImagesSize(image))return 0;
-	features = (CvPoint2D32f*)realloc(features, 2048*sizeof(CvPoint2D32f));
-	if(!features){strcpy_s(error, 255, "OpticalFlowTracker::findFeaturesEigVals failed"); return 0;}
-	int fcount = 2048;
-	cvGoodFeaturesToTrack(image, eigImage, tempImage, features, &fcount,
-					threshold, minDistance*(float)image->cols, 0, 3, 0, 0.04);
-	count = (unsigned int)fcount;
+	
+	//Tiles narrower than MIN_TILE_SIZE would mostly hold border pixels
+	int cols = MIN(tileCols, MAX(image->cols / MIN_TILE_SIZE, 1));
+	int rows = MIN(tileRows, MAX(image->rows / MIN_TILE_SIZE, 1));
+	int tiles = cols * rows;
+	
+	if((tiles == 1)&&!mask){
+		int fcount = (int)maxCount;
+		cvGoodFeaturesToTrack(image, eigImage, tempImage, features, &fcount,
+						threshold, minDistance*(float)image->cols, 0, 3, 0, 0.04);
+		count = (unsigned int)fcount;
+		return 1;
+	}
+	
+	//Each tile writes up to quota points at tile * quota. The quota changes
+	//with maxCount and the tile layout, so the buffer is sized in points.
+	int quota = (int)maxCount / tiles;
+	if(quota < 1)quota = 1;
+	if((unsigned int)tiles > tileCapacity){
+		if(!growArray(&tileCounts, tiles)){
+			strcpy_s(error, 255, "FeatureDetector::findFeaturesEigVals failed: tiles");
+			return 0;
+		}
+		tileCapacity = tiles;
+		allocations++;
+	}
+	if((unsigned int)(tiles * quota) > tileFeatureCapacity){
+		unsigned int n = growCapacity(tileFeatureCapacity, tiles * quota);
+		if(!growArray(&tileFeatures, n)){
+			strcpy_s(error, 255, "FeatureDetector::findFeaturesEigVals failed: tile features");
+			return 0;
+		}
+		tileFeatureCapacity = n;
+		allocations++;
+	}
+	
+	if(tiles == 1)findFeaturesEigValsTile(image, mask, 0, 1, 1, quota);
+	else cv::parallel_for_(cv::Range(0, tiles), EigValsTileBody(this, image, mask, cols, rows, quota));
+	
+	//Tiles enforce minDistance internally only, so check features against
+	//those already kept from other tiles.
+	float dist = minDistance*(float)image->cols;
+	bool prune = dist > 0.f;
+	int t, i;
+	count = 0;
+	if(prune)grid.setup(0.f, 0.f, (float)image->cols, (float)image->rows, dist, MAX_EIG_FEATURE_COUNT);
+	for(t=0;t<tiles;t++){
+		const CvPoint2D32f *f = tileFeatures + t * quota;
+		for(i=0;(i<tileCounts[t])&&(count<maxCount);i++){
+			if(prune){
+				if(grid.hasNeighbour(f[i].x, f[i].y, dist*dist, -1))continue;
+				grid.insert(f[i].x, f[i].y);
+			}
+			features[count++] = f[i];
+		}
+	}
 	return 1;
 }
 		
-char FeatureDetector::findFeaturesFAST(CvMat* image){
+/****FAST****/
+
+//Bresenham circle of radius 3, clockwise from the top
+static const int fastCircle[16][2] = {
+	{0,-3}, {1,-3}, {2,-2}, {3,-1}, {3,0}, {3,1}, {2,2}, {1,3},
+	{0,3}, {-1,3}, {-2,2}, {-3,1}, {-3,0}, {-3,-1}, {-2,-2}, {-1,-3}
+};
+
+//True if mask has at least 9 contiguous bits set, wrapping around 16 bits
+static inline bool hasArc9(unsigned int mask){
+	unsigned int m = mask | (mask << 16);
+	m &= m >> 1;	//runs of 2
+	m &= m >> 2;	//runs of 4
+	m &= m >> 4;	//runs of 8
+	m &= m >> 1;	//runs of 9
+	return m != 0;
+}
+
+//Highest arc minimum for one polarity: the largest threshold at which the
+//pixel would still be a corner.
+static inline int arcScore(const int *d){
+	int best = 0, k, j, m;
+	for(k=0;k<16;k++){
+		m = d[k];
+		for(j=1;(j<9)&&(m>best);j++)if(d[(k+j)&15] < m)m = d[(k+j)&15];
+		if(m > best)best = m;
+	}
+	return best;
+}
+
+//Returns the FAST-9 score of p, or 0 if p is not a corner for threshold t.
+static inline int fastScore(const uchar *p, const int *offsets, int t){
+	int v = *p, k, d, bright[16], dark[16];
+	unsigned int bmask = 0, dmask = 0;
+	for(k=0;k<16;k++){
+		d = (int)p[offsets[k]] - v;
+		bright[k] = d;
+		dark[k] = -d;
+		if(d > t)bmask |= 1u << k;
+		else if(d < -t)dmask |= 1u << k;
+	}
+	if(hasArc9(bmask))return arcScore(bright);
+	if(hasArc9(dmask))return arcScore(dark);
+	return 0;
+}
+
+struct FastCornerGreater{
+	bool operator()(const FastCorner &a, const FastCorner &b) const{
+		if(a.score != b.score)return a.score > b.score;
+		if(a.y != b.y)return a.y < b.y;
+		return a.x < b.x;
+	}
+};
+
+char FeatureDetector::adjustScoreImageSize(CvMat* image){
+	if(scoreImage && CV_ARE_SIZES_EQ(scoreImage, image))return 1;
+	if(scoreImage)cvReleaseMat(&scoreImage);
+	allocations++;
+	scoreImage = cvCreateMat(image->rows, image->cols, CV_8UC1);
+	if(!scoreImage){
+		strcpy_s(error, 256, "FeatureDetector::adjustScoreImageSize failed");
+		return 0;
+	}
+	return 1;
+}
+
+/*FAST-9 segment test: a pixel is a corner if 9 contiguous pixels on the
+  circle around it are all brighter, or all darker, than the centre by more
+  than fastThreshold. Corners go through 3x3 non-maximum suppression, are
+  kept if their score is at least threshold times the best score, then
+  picked by decreasing score while enforcing minDistance.*/
+char FeatureDetector::findFeaturesFAST(CvMat* image, CvMat* mask){
+	CVFLOW_TASK("findFeaturesFAST");
+	count = 0;
+	if((image->rows < 7)||(image->cols < 7))return 1;
+	if(CV_MAT_TYPE(image->type) != CV_8UC1){strcpy_s(error, 255, "FeatureDetector::findFeaturesFAST failed: input must be 8-bit, 1 plane"); return 0;}
+	if(!adjustScoreImageSize(image))return 0;
+	cvZero(scoreImage);
+	
+	const int t = fastThreshold;
+	const int sstep = scoreImage->step;
+	int offsets[16];
+	int x, y, k, a, b, c, d, score, maxScore = 0;
+	unsigned int i, n = 0;
+	
+	for(k=0;k<16;k++)offsets[k] = fastCircle[k][1] * image->step + fastCircle[k][0];
+	
+	for(y=3;y<image->rows-3;y++){
+		const uchar *row = image->data.ptr + y * image->step;
+		uchar *srow = scoreImage->data.ptr + y * sstep;
+		const uchar *mrow = mask ? mask->data.ptr + y * mask->step : 0;
+		for(x=3;x<image->cols-3;x++){
+			if(mrow && !mrow[x])continue;
+			const uchar *p = row + x;
+			int hi = p[0] + t, lo = p[0] - t;
+			//Any 9-pixel arc contains at least two of the four compass points
+			a = p[offsets[0]]; b = p[offsets[4]]; c = p[offsets[8]]; d = p[offsets[12]];
+			if(((a>hi)+(b>hi)+(c>hi)+(d>hi) < 2)&&((a<lo)+(b<lo)+(c<lo)+(d<lo) < 2))continue;
+			score = fastScore(p, offsets, t);
+			if(!score)continue;
+			if(n >= cornerCapacity){
+				unsigned int capacity = growCapacity(cornerCapacity, n + 1);
+				if(!growArray(&corners, capacity)){strcpy_s(error, 255, "FeatureDetector::findFeaturesFAST failed: corners"); return 0;}
+				cornerCapacity = capacity;
+				allocations++;
+			}
+			srow[x] = (uchar)score;
+			corners[n].x = x;
+			corners[n].y = y;
+			corners[n].score = score;
+			n++;
+		}
+	}
+	
+	//Non-maximum suppression. Ties go to the pixel that comes first in
+	//raster order, so plateaus keep exactly one corner.
+	unsigned int kept = 0;
+	for(i=0;i<n;i++){
+		const uchar *sp = scoreImage->data.ptr + corners[i].y * sstep + corners[i].x;
+		score = corners[i].score;
+		if((sp[-sstep-1] >= score)||(sp[-sstep] >= score)||(sp[-sstep+1] >= score)||(sp[-1] >= score))continue;
+		if((sp[1] > score)||(sp[sstep-1] > score)||(sp[sstep] > score)||(sp[sstep+1] > score))continue;
+		if(score > maxScore)maxScore = score;
+		corners[kept++] = corners[i];
+	}
+	
+	//Quality level, relative to the strongest corner as in cvGoodFeaturesToTrack
+	int minScore = cvCeil(threshold * (float)maxScore);
+	for(i=0, n=0;i<kept;i++)if(corners[i].score >= minScore)corners[n++] = corners[i];
+	std::sort(corners, corners + n, FastCornerGreater());
+	
+	float dist = minDistance*(float)image->cols;
+	bool prune = dist > 0.f;
+	if(prune)grid.setup(0.f, 0.f, (float)image->cols, (float)image->rows, dist, MAX_EIG_FEATURE_COUNT);
+	for(i=0;(i<n)&&(count<maxCount);i++){
+		float fx = (float)corners[i].x, fy = (float)corners[i].y;
+		if(prune){
+			if(grid.hasNeighbour(fx, fy, dist*dist, -1))continue;
+			grid.insert(fx, fy);
+		}
+		features[count] = cvPoint2D32f(fx, fy);
+		count++;
+	}
+	
 	return 1;
 }
\ No newline at end of file
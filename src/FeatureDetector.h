@@ -2,11 +2,20 @@
 #define _FEATUREDETECTOR_H
 
 #include "opencv.hpp"
+#include "Portability.h"
+#include "SpatialGrid.h"
 
 #define FEATURE_ALGO_EIGENVALS 0
 #define FEATURE_ALGO_FAST 1
 
 #define MAX_EIG_FEATURE_COUNT 2048 
+#define MIN_TILE_SIZE 32
+
+typedef struct _fast_corner{
+	int x;
+	int y;
+	int score;
+} FastCorner;
 
 class FeatureDetector{
 	private:
@@ -14,33 +23,88 @@ class FeatureDetector{
 		CvPoint2D32f *previousFeatures;
 		CvMat *tempImage;
 		CvMat *eigImage;
+		CvMat *scoreImage;
+		CvMat *mask;
+		const CvPoint2D32f *occupied;
+		const char *occupiedStatus;
+		unsigned int occupiedCount;
+		float occupiedRadius;
+		bool useOccupancy;
+		unsigned int interval;
+		unsigned int frameIndex;
+		FastCorner *corners;
+		unsigned int cornerCapacity;
+		SpatialGrid grid;
+		CvPoint2D32f *tileFeatures;
+		int *tileCounts;
+		unsigned int tileCapacity;			//in tiles, for tileCounts
+		unsigned int tileFeatureCapacity;	//in points, for tileFeatures
+		int tileCols;
+		int tileRows;
 		unsigned int count;
 		unsigned int previousCount;
+		unsigned int allocations;
 		int algorithm;
 		float threshold;
 		float minDistance;
+		int fastThreshold;
+		unsigned int maxCount;
 		char error[256];
 		
 		char adjustTempImagesSize(CvMat* image);
+		char allocateFeatures();
+		char adjustScoreImageSize(CvMat* image);
+		char buildOccupancyMask(CvMat* image);
+		void findFeaturesEigValsTile(CvMat* image, CvMat* mask, int tile, int cols, int rows, int quota);
+		
+		friend class EigValsTileBody;
 		
-		char findFeaturesEigVals(CvMat* image);
-		char findFeaturesFAST(CvMat* image);
+		char findFeaturesEigVals(CvMat* image, CvMat* mask);
+		char findFeaturesFAST(CvMat* image, CvMat* mask);
 		
 	public:
 		FeatureDetector(){
 			count = 0;
+			previousCount = 0;
+			allocations = 0;
 			tempImage = 0;
 			eigImage = 0;
+			scoreImage = 0;
+			mask = 0;
+			occupied = NULL;
+			occupiedStatus = NULL;
+			occupiedCount = 0;
+			occupiedRadius = 0.f;
+			useOccupancy = false;
+			interval = 1;
+			frameIndex = 0;
+			corners = NULL;
+			cornerCapacity = 0;
+			fastThreshold = 20;
+			maxCount = MAX_EIG_FEATURE_COUNT;
+			tileFeatures = NULL;
+			tileCounts = NULL;
+			tileCapacity = 0;
+			tileFeatureCapacity = 0;
+			tileCols = 1;
+			tileRows = 1;
 			algorithm = FEATURE_ALGO_EIGENVALS;
 			minDistance = 0.01f;
 			threshold = 0.1f;
 			features = NULL;
 			previousFeatures = NULL;
+			error[0] = 0;
 		}
 		~FeatureDetector(){
 			if(features)free(features);
+			if(previousFeatures)free(previousFeatures);
 			if(tempImage)cvReleaseMat(&tempImage);
 			if(eigImage)cvReleaseMat(&eigImage);
+			if(scoreImage)cvReleaseMat(&scoreImage);
+			if(mask)cvReleaseMat(&mask);
+			if(corners)free(corners);
+			if(tileFeatures)free(tileFeatures);
+			if(tileCounts)free(tileCounts);
 		}
 		
 		void setMinDistance(float d){
@@ -57,6 +121,65 @@ class FeatureDetector{
 		}
 		float getThreshold(){return threshold;}
 		
+		//FAST only: minimal intensity difference between the centre and the
+		//circle. threshold then acts as a fraction of the best corner score.
+		void setFastThreshold(int t){
+			if(t < 1)fastThreshold = 1;
+			else if(t > 254)fastThreshold = 254;
+			else fastThreshold = t;
+		}
+		int getFastThreshold(){return fastThreshold;}
+		
+		//Shi-Tomasi only: the frame is split in cols x rows tiles, detected in
+		//parallel, each with an equal share of maxCount and a
+		//quality threshold relative to its own best corner.
+		void setTiles(int cols, int rows){
+			tileCols = cols < 1 ? 1 : cols;
+			tileRows = rows < 1 ? 1 : rows;
+		}
+		int getTileCols(){return tileCols;}
+		int getTileRows(){return tileRows;}
+		
+		//Points already tracked, used by the next findFeatures() call only.
+		//Corners within radius of points whose status is set (status may be
+		//NULL) are not returned, since updateFeatureList would drop them anyway.
+		void setOccupied(const CvPoint2D32f *points, const char *status, unsigned int n, float radius){
+			occupied = points;
+			occupiedStatus = status;
+			occupiedCount = n;
+			occupiedRadius = radius;
+		}
+		//Off by default. When on, threshold is relative to the best corner
+		//outside the occupied areas rather than in the whole frame, so weaker
+		//corners are accepted than without it. FAST skips covered pixels, but
+		//for Shi-Tomasi it is a filter, not a saving: eigenvalues are still
+		//computed for every pixel of a tile unless the whole tile is covered,
+		//which tracks spaced minDistance apart almost never do.
+		void setUseOccupancy(bool o){useOccupancy = o;}
+		bool getUseOccupancy(){return useOccupancy;}
+		
+		//Largest number of features returned by one detection
+		void setMaxCount(unsigned int n){maxCount = n < 1 ? 1 : (n > MAX_EIG_FEATURE_COUNT ? MAX_EIG_FEATURE_COUNT : n);}
+		unsigned int getMaxCount(){return maxCount;}
+		
+		//Only detect once every n frames, other frames return no features
+		void setInterval(unsigned int n){interval = n < 1 ? 1 : n;}
+		unsigned int getInterval(){return interval;}
+		void restart(){frameIndex = 0;}
+		
+		//Copies every setting of d except the interval, which is left at 1
+		void copySettings(const FeatureDetector &d){
+			algorithm = d.algorithm;
+			threshold = d.threshold;
+			minDistance = d.minDistance;
+			fastThreshold = d.fastThreshold;
+			tileCols = d.tileCols;
+			tileRows = d.tileRows;
+			useOccupancy = d.useOccupancy;
+			maxCount = d.maxCount;
+			interval = 1;
+		}
+		
 		void setAlgorithm(int a){algorithm = a;}
 		int getAlgorithm(){return algorithm;}
 		
@@ -65,6 +188,9 @@ class FeatureDetector{
 		CvPoint2D32f* getFeaturePtr(){return features;}
 		CvPoint2D32f* getPreviousFeaturePtr(){return previousFeatures;}
 		
+		//Number of times a buffer or temporary image had to be (re)allocated
+		unsigned int getAllocationCount(){return allocations + grid.getAllocationCount();}
+		
 		char findFeatures(CvMat* image);
 		
 		const char* getErrorMess(){return error;}
@@ -0,0 +1,188 @@
+#include "FlowField.h"
+#include "GrowArray.h"
+#include "Profiling.h"
+
+
+/*******************************Constructor/Destructor*********************************/
+FlowField::FlowField(){
+	current = &pyramids[0];
+	previous = &pyramids[1];
+	mask = 0;
+	eigImage = 0;
+	tmpImage = 0;
+	points = 0;
+	newPoints = 0;
+	found = 0;
+	status = 0;
+	capacity = 0;
+	allocations = 0;
+	pointCount = 0;
+	featureCount = 0;
+	threshold = 0.1f;
+	distance = 5.f;
+	maxPoints = 128;
+	radius = 5;
+	motionThreshold = 3;
+	dilation = 0;
+	mode = 0;
+	useGlobalMotion = false;
+	traceId = TraceRecorder::get().newInstance("cv.jit.flowfield");
+	frameIndex = 0;
+	error[0] = 0;
+}
+
+FlowField::~FlowField(){
+	releaseImages();
+	free(points);
+	free(newPoints);
+	free(found);
+	free(status);
+}
+
+
+/*******************************Private methods*********************************/
+
+void FlowField::releaseImages(){
+	if(mask)cvReleaseMat(&mask);
+	if(eigImage)cvReleaseMat(&eigImage);
+	if(tmpImage)cvReleaseMat(&tmpImage);
+	pyramids[0].invalidate();
+	pyramids[1].invalidate();
+}
+
+char FlowField::adjustImages(CvMat *image){
+	if(eigImage && CV_ARE_SIZES_EQ(eigImage, image))return 1;
+
+	releaseImages();
+	mask = cvCreateMat(image->rows, image->cols, CV_8UC1);
+	eigImage = cvCreateMat(image->rows, image->cols, CV_32FC1);
+	tmpImage = cvCreateMat(image->rows, image->cols, CV_32FC1);
+	if((!mask)||(!eigImage)||(!tmpImage)){
+		releaseImages();
+		strcpy_s(error, 255, "FlowField::adjustImages failed");
+		return 0;
+	}
+	pointCount = 0;
+	return 1;
+}
+
+char FlowField::reservePoints(unsigned int n){
+	if(n <= capacity)return 1;
+	if(!growArray(&points, n) || !growArray(&newPoints, n) || !growArray(&found, n) || !growArray(&status, n)){
+		strcpy_s(error, 255, "FlowField::reservePoints failed");
+		return 0;
+	}
+	capacity = n;
+	allocations++;
+	return 1;
+}
+
+/*Mode 1: tracks that survived the last pass keep their slot, and lost
+  slots are refilled in place with new features, so a point's index stays
+  the same for as long as it is tracked. A slot left when detection runs
+  out keeps its last position. Remaining features top the list up to
+  maxPoints. A new feature closer than distance to a kept track would only
+  duplicate it, so the kept tracks go in a grid and such features are
+  skipped. Returns the new point count.*/
+int FlowField::recyclePoints(int foundCount){
+	int i, j;
+	int n = MIN(pointCount, maxPoints);
+	float sqDistance = distance * distance;
+
+	grid.setup(0.f, 0.f, (float)current->getImage()->cols, (float)current->getImage()->rows, distance, (unsigned int)maxPoints);
+	for(i=0;i<n;i++){
+		if(status[i] == 1){
+			points[i] = newPoints[i];
+			grid.insert(newPoints[i].x, newPoints[i].y);
+		}
+	}
+	for(i=0,j=0;i<n;i++){
+		if(status[i] == 1)continue;
+		while((j<foundCount)&&grid.hasNeighbour(found[j].x, found[j].y, sqDistance, -1))j++;
+		if(j<foundCount)points[i] = found[j++];
+	}
+	for(;(j<foundCount)&&(i<maxPoints);j++){
+		if(!grid.hasNeighbour(found[j].x, found[j].y, sqDistance, -1))points[i++] = found[j];
+	}
+	return i;
+}
+
+/*******************************Public methods*********************************/
+
+char FlowField::processFrame(CvMat *image){
+	int i;
+	CvSize window;
+	ImagePyramid *tmp;
+	StageTimer frameTimer;
+	CVFLOW_FRAME(traceId, frameIndex++);
+	CVFLOW_TASK("processFrame");
+
+	if(!image){strcpy_s(error, 255, "FlowField::processFrame failed"); return 0;}
+	if(!adjustImages(image))return 0;
+	if(!reservePoints((unsigned int)maxPoints))return 0;
+
+	featureCount = maxPoints;
+	window.height = window.width = radius * 2 + 1;
+
+	//The pyramid keeps a copy of the frame for the next pass
+	if(!current->build(image, window, 3)){strcpy_s(error, 255, current->getErrorMess()); return 0;}
+	if(!previous->sameSize(*current) || !previous->fits(window, 3)){
+		//No previous frame to compare with yet
+		featureCount = 0;
+		pointCount = 0;
+		CV_SWAP(current, previous, tmp);
+		latency.add(frameTimer.lap());
+		return 1;
+	}
+
+	//Frame differencing and threshold, straight into the mask
+	if(!motion.compute(image, previous->getImage(), mask, motionThreshold, dilation)){
+		strcpy_s(error, 255, motion.getErrorMess());
+		return 0;
+	}
+
+	if(mode == 1){ //Use features from previous pass
+		CVFLOW_TASK("detectFeatures");
+		//Find strong features only in areas where movement was detected
+		cvGoodFeaturesToTrack(image, eigImage, tmpImage, found, &featureCount, threshold, distance, mask, 3, 0, 0.04);
+		featureCount = recyclePoints(featureCount);
+	}
+	else{
+		CVFLOW_TASK("detectFeatures");
+		//Find strong features only in areas where movement was detected
+		cvGoodFeaturesToTrack(image, eigImage, tmpImage, points, &featureCount, threshold, distance, mask, 3, 0, 0.04);
+	}
+
+	//Find optical flow for detected features
+	if(featureCount > 0){
+		int flags = 0;
+		globalMotion.reset();
+		if(useGlobalMotion){
+			if(!globalMotion.estimate(*previous, *current)){strcpy_s(error, 255, globalMotion.getErrorMess()); return 0;}
+			CvPoint2D32f g = globalMotion.getShift();
+			for(i=0;i<featureCount;i++){
+				newPoints[i].x = MIN(MAX(points[i].x + g.x, 0.f), (float)(image->cols - 1));
+				newPoints[i].y = MIN(MAX(points[i].y + g.y, 0.f), (float)(image->rows - 1));
+			}
+			flags = cv::OPTFLOW_USE_INITIAL_FLOW;
+		}
+		if(!lk.track(previous, current, points, newPoints, status, 0, featureCount, window, 3,
+			cvTermCriteria(CV_TERMCRIT_ITER|CV_TERMCRIT_EPS,20,0.03), flags)){
+			strcpy_s(error, 255, lk.getErrorMess());
+			return 0;
+		}
+	}
+	pointCount = featureCount;
+
+	CV_SWAP(current, previous, tmp);
+
+	latency.add(frameTimer.lap());
+	return 1;
+}
+
+void FlowField::reset(){
+	releaseImages();
+	globalMotion.reset();
+	pointCount = 0;
+	featureCount = 0;
+}
@@ -0,0 +1,120 @@
+#ifndef _FLOWFIELD_H_
+#define _FLOWFIELD_H_
+
+#include "opencv.hpp"
+#include "Portability.h"
+#include "ParallelLK.h"
+#include "GlobalMotion.h"
+#include "SpatialGrid.h"
+#include "MotionMask.h"
+#include "FlowStats.h"
+
+#define MAXPOINTS 16384		//Upper bound for maxPoints, buffers only grow to what is used
+
+/*Sparse optical flow restricted to moving areas of the image:
+  features are detected where the frame difference exceeds motionThreshold,
+  then tracked into the next frame with pyramidal Lucas-Kanade.*/
+class FlowField{
+	private:
+		//Images for processing
+		ImagePyramid pyramids[2];
+		ImagePyramid *current;
+		ImagePyramid *previous;
+		MotionMask motion;
+		CvMat *mask;
+		CvMat *eigImage;
+		CvMat *tmpImage;
+		ParallelLK lk;
+		GlobalMotion globalMotion;
+
+		//Arrays for tracking, grown to maxPoints
+		CvPoint2D32f *points;
+		CvPoint2D32f *newPoints;
+		CvPoint2D32f *found;		//New features
+		char *status;
+		unsigned int capacity;
+		SpatialGrid grid;			//Tracks kept in mode 1
+		unsigned int allocations;
+
+		int pointCount;
+		int featureCount;
+
+		//Parameters
+		float threshold;
+		float distance;
+		int maxPoints;
+		int radius;
+		int motionThreshold;
+		int dilation;
+		int mode;
+		bool useGlobalMotion;
+		int traceId;
+		unsigned int frameIndex;
+		LatencyHistogram latency;	//processFrame, successful frames only
+
+		char error[256];
+
+		void releaseImages();
+		char adjustImages(CvMat *image);
+		char reservePoints(unsigned int n);
+		int recyclePoints(int foundCount);
+
+	public:
+		FlowField();
+		~FlowField();
+
+		void setThreshold(float t){threshold = t < 0.001f ? 0.001f : (t > 1.f ? 1.f : t);}
+		float getThreshold(){return threshold;}
+
+		void setDistance(float d){distance = d < 1.f ? 1.f : d;}
+		float getDistance(){return distance;}
+
+		void setMaxPoints(int n){maxPoints = n < 1 ? 1 : (n > MAXPOINTS ? MAXPOINTS : n);}
+		int getMaxPoints(){return maxPoints;}
+
+		void setRadius(int r){radius = r < 1 ? 1 : r;}
+		int getRadius(){return radius;}
+
+		void setMotionThreshold(int t){motionThreshold = t < 0 ? 0 : (t > 255 ? 255 : t);}
+		int getMotionThreshold(){return motionThreshold;}
+
+		//Grows the motion mask by this many pixels to close small holes
+		void setDilation(int d){dilation = d < 0 ? 0 : (d > MOTIONMASK_MAX_RADIUS ? MOTIONMASK_MAX_RADIUS : d);}
+		int getDilation(){return dilation;}
+
+		void setThreads(int t){lk.setThreads(t);}
+		int getThreads(){return lk.getThreads();}
+
+		//Seeds LK with the translation of the whole frame
+		void setGlobalMotion(bool g){useGlobalMotion = g;}
+		bool getGlobalMotion(){return useGlobalMotion;}
+		CvPoint2D32f getGlobalShift(){return globalMotion.getShift();}
+
+		void setMode(int m){mode = m;}
+		int getMode(){return mode;}
+
+		int getFeatureCount(){return featureCount;}
+		//Instance id and frame number in TraceRecorder timelines
+		int getTraceId(){return traceId;}
+		unsigned int getFrameIndex(){return frameIndex;}
+		//processFrame times since construction or the last resetLatency()
+		const LatencyHistogram& getLatency(){return latency;}
+		void resetLatency(){latency.reset();}
+		CvPoint2D32f* getPointPtr(){return points;}
+		CvPoint2D32f* getNewPointPtr(){return newPoints;}
+		char* getStatusPtr(){return status;}
+
+		const char* getErrorMess(){return error;}
+
+		//Number of times the point buffers had to grow
+		unsigned int getAllocationCount(){
+			return allocations + grid.getAllocationCount() + motion.getAllocationCount() +
+				pyramids[0].getAllocationCount() + pyramids[1].getAllocationCount() +
+				globalMotion.getAllocationCount();
+		}
+
+		char processFrame(CvMat *image);
+		void reset();
+};
+
+#endif
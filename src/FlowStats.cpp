@@ -0,0 +1,31 @@
+#include "FlowStats.h"
+
+FlowStats::FlowStats(){
+	stageCount = 0;
+	for(int i=0;i<FLOW_STATS_MAX_STAGES;i++)names[i] = "";
+	reset();
+}
+
+void FlowStats::setStages(const char *const *stageNames, int count){
+	stageCount = count < FLOW_STATS_MAX_STAGES ? count : FLOW_STATS_MAX_STAGES;
+	for(int i=0;i<stageCount;i++)names[i] = stageNames[i];
+	reset();
+}
+
+void FlowStats::record(int stage, double ms){
+	if((stage < 0)||(stage >= stageCount))return;
+	last[stage] = ms;
+	sum[stage] += ms;
+	if(ms > max[stage])max[stage] = ms;
+	samples[stage]++;
+}
+
+void FlowStats::reset(){
+	for(int i=0;i<FLOW_STATS_MAX_STAGES;i++){
+		last[i] = sum[i] = max[i] = 0.;
+		samples[i] = 0;
+	}
+	frames = 0;
+	features = vectors = goodVectors = 0;
+	latency.reset();
+}
@@ -0,0 +1,52 @@
+#ifndef _FLOWSTATS_H_
+#define _FLOWSTATS_H_
+
+#include "opencv.hpp"
+#include "LatencyHistogram.h"
+
+#define FLOW_STATS_MAX_STAGES 12
+
+/*Per-stage timings in milliseconds: last value, mean and maximum since the
+  last reset, plus the feature counts of the last frame and the latency
+  distribution of whole frames. Stage names are static strings, so stats
+  can be copied freely across threads.*/
+class FlowStats{
+	public:
+		int stageCount;
+		const char *names[FLOW_STATS_MAX_STAGES];
+		double last[FLOW_STATS_MAX_STAGES];
+		double sum[FLOW_STATS_MAX_STAGES];
+		double max[FLOW_STATS_MAX_STAGES];
+		unsigned int samples[FLOW_STATS_MAX_STAGES];
+		unsigned int frames;
+		unsigned int features;
+		unsigned int vectors;
+		unsigned int goodVectors;
+		LatencyHistogram latency;	//Whole frames, for tail latency
+
+		FlowStats();
+		~FlowStats(){;}
+
+		void setStages(const char *const *stageNames, int count);
+		void record(int stage, double ms);
+		void reset();
+
+		double getMean(int stage) const {return samples[stage] ? sum[stage] / samples[stage] : 0.;}
+};
+
+//High resolution stopwatch for stage timings
+class StageTimer{
+	private:
+		int64 start;
+	public:
+		StageTimer(){start = cv::getTickCount();}
+		//Milliseconds since construction or the last lap
+		double lap(){
+			int64 now = cv::getTickCount();
+			double ms = (double)(now - start) * 1000. / cv::getTickFrequency();
+			start = now;
+			return ms;
+		}
+};
+
+#endif
@@ -0,0 +1,110 @@
+#include "FlowVectors.h"
+#include "SimdIntrinsics.h"
+#include "GrowArray.h"
+
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+//Same polynomial as cv::fastAtan2, in degrees
+static const float atan2_p1 = 0.9997878412794807f*(float)(180/CV_PI);
+static const float atan2_p3 = -0.3258083974640975f*(float)(180/CV_PI);
+static const float atan2_p5 = 0.1555786518463281f*(float)(180/CV_PI);
+static const float atan2_p7 = -0.04432655554792128f*(float)(180/CV_PI);
+
+static inline float fastAtan2Deg(float y, float x){
+	float ax = fabsf(x), ay = fabsf(y);
+	float a, c, c2;
+	if(ax >= ay){
+		c = ay/(ax + (float)DBL_EPSILON);
+		c2 = c*c;
+		a = (((atan2_p7*c2 + atan2_p5)*c2 + atan2_p3)*c2 + atan2_p1)*c;
+	}
+	else{
+		c = ax/(ay + (float)DBL_EPSILON);
+		c2 = c*c;
+		a = 90.f - (((atan2_p7*c2 + atan2_p5)*c2 + atan2_p3)*c2 + atan2_p1)*c;
+	}
+	if(x < 0)a = 180.f - a;
+	if(y < 0)a = 360.f - a;
+	return a;
+}
+
+FlowVectors::FlowVectors(){
+	x = y = x2 = y2 = alpha = theta = fbError = 0;
+	friends = age = index = 0;
+	count = 0;
+	capacity = 0;
+	allocations = 0;
+}
+
+FlowVectors::~FlowVectors(){
+	release();
+}
+
+char FlowVectors::reserve(unsigned int n){
+	if(n <= capacity)return 1;
+	n = growCapacity(capacity, n);
+	if(!growArray(&x, n) || !growArray(&y, n) || !growArray(&x2, n) || !growArray(&y2, n) ||
+		!growArray(&alpha, n) || !growArray(&theta, n) || !growArray(&fbError, n) ||
+		!growArray(&friends, n) || !growArray(&age, n) || !growArray(&index, n))return 0;
+	capacity = n;
+	allocations++;
+	return 1;
+}
+
+void FlowVectors::release(){
+	free(x); free(y); free(x2); free(y2);
+	free(alpha); free(theta); free(fbError);
+	free(friends); free(age); free(index);
+	x = y = x2 = y2 = alpha = theta = fbError = 0;
+	friends = age = index = 0;
+	count = 0;
+	capacity = 0;
+}
+
+void FlowVectors::computePolar(float scaleX, float scaleY){
+	unsigned int i = 0;
+	float dx, dy;
+
+#if CV_SIMD128
+	const cv::v_float32x4 sx = cv::v_setall_f32(scaleX), sy = cv::v_setall_f32(scaleY);
+	const cv::v_float32x4 zero = cv::v_setzero_f32(), eps = cv::v_setall_f32((float)DBL_EPSILON);
+	const cv::v_float32x4 p1 = cv::v_setall_f32(atan2_p1), p3 = cv::v_setall_f32(atan2_p3);
+	const cv::v_float32x4 p5 = cv::v_setall_f32(atan2_p5), p7 = cv::v_setall_f32(atan2_p7);
+	const cv::v_float32x4 d90 = cv::v_setall_f32(90.f), d180 = cv::v_setall_f32(180.f), d360 = cv::v_setall_f32(360.f);
+
+	for(;i+4<=count;i+=4){
+		cv::v_float32x4 vx = cv::v_load(x+i) * sx, vy = cv::v_load(y+i) * sy;
+		cv::v_float32x4 vx2 = cv::v_load(x2+i) * sx, vy2 = cv::v_load(y2+i) * sy;
+		cv::v_store(x+i, vx); cv::v_store(y+i, vy);
+		cv::v_store(x2+i, vx2); cv::v_store(y2+i, vy2);
+
+		cv::v_float32x4 vdx = vx - vx2, vdy = vy - vy2;
+		cv::v_store(alpha+i, cv::v_sqrt(vdx*vdx + vdy*vdy));
+
+		cv::v_float32x4 ax = cv::v_abs(vdx), ay = cv::v_abs(vdy);
+		cv::v_float32x4 c = cv::v_min(ax, ay) / (cv::v_max(ax, ay) + eps);
+		cv::v_float32x4 c2 = c*c;
+		cv::v_float32x4 a = (((p7*c2 + p5)*c2 + p3)*c2 + p1)*c;
+		a = cv::v_select(ax >= ay, a, d90 - a);
+		a = cv::v_select(vdx < zero, d180 - a, a);
+		a = cv::v_select(vdy < zero, d360 - a, a);
+		cv::v_store(theta+i, a);
+	}
+#endif
+
+	for(;i<count;i++){
+		x[i] *= scaleX;
+		y[i] *= scaleY;
+		x2[i] *= scaleX;
+		y2[i] *= scaleY;
+		dx = x[i] - x2[i];
+		dy = y[i] - y2[i];
+		alpha[i] = sqrtf(dx*dx+dy*dy);
+		theta[i] = fastAtan2Deg(dy,dx);
+	}
+
+	if(count)memset(friends, 0, sizeof(unsigned int)*count);
+}
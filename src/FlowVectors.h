@@ -0,0 +1,38 @@
+#ifndef _FLOWVECTORS_H_
+#define _FLOWVECTORS_H_
+
+#include "opencv.hpp"
+
+/*Motion vectors stored as one contiguous array per field, so that each
+  stage only streams the fields it reads. Coordinates are normalized to
+  0-1, alpha is the magnitude and theta the angle in degrees of (x,y)-(x2,y2).
+  fbError is the forward-backward tracking error in pixels, 0 when unchecked.
+  Arrays only grow and are reused from frame to frame.*/
+class FlowVectors{
+	public:
+		float *x;
+		float *y;
+		float *x2;
+		float *y2;
+		float *alpha;
+		float *theta;
+		float *fbError;
+		unsigned int *friends;
+		unsigned int *age;
+		unsigned int *index;
+		unsigned int count;
+		unsigned int capacity;
+		unsigned int allocations;	//number of times reserve() had to grow the arrays
+
+		FlowVectors();
+		~FlowVectors();
+
+		char reserve(unsigned int n);
+		void release();
+
+		/*Scales the first count positions by (scaleX, scaleY), then computes
+		  alpha and theta and clears friends. Vectorized where available.*/
+		void computePolar(float scaleX, float scaleY);
+};
+
+#endif
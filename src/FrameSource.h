@@ -0,0 +1,39 @@
+#ifndef _FRAMESOURCE_H_
+#define _FRAMESOURCE_H_
+
+#include "opencv.hpp"
+
+#include <math.h>
+
+/*Synthetic camera for cvflow_bench and the tests: a blurred noise texture
+  panned along a Lissajous path so that every frame has texture and
+  non-trivial motion. The same seed always gives the same frames.*/
+class FrameSource{
+	private:
+		cv::Mat texture;
+		cv::Mat frame;
+		int margin;
+		int index;
+
+	public:
+		FrameSource(int width, int height, int seed){
+			margin = 32;
+			index = 0;
+			cv::RNG rng(seed);
+			texture.create(height + 2 * margin, width + 2 * margin, CV_8UC1);
+			rng.fill(texture, cv::RNG::UNIFORM, 0, 256);
+			cv::GaussianBlur(texture, texture, cv::Size(5, 5), 1.5);
+			frame.create(height, width, CV_8UC1);
+		}
+
+		//The returned header points into storage that the next call overwrites
+		CvMat next(){
+			double t = (double)index++;
+			int ox = margin + cvRound((margin - 1) * sin(t * 0.05));
+			int oy = margin + cvRound((margin - 1) * sin(t * 0.035 + 1.0));
+			texture(cv::Rect(ox, oy, frame.cols, frame.rows)).copyTo(frame);
+			return frame;
+		}
+};
+
+#endif
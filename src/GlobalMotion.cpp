@@ -0,0 +1,59 @@
+#include "GlobalMotion.h"
+#include "Profiling.h"
+
+GlobalMotion::GlobalMotion(){
+	shift = cvPoint2D32f(0.f, 0.f);
+	response = 0.;
+	minResponse = 0.05;
+	maxWidth = 160;
+	allocations = 0;
+	error[0] = 0;
+}
+
+void GlobalMotion::reset(){
+	shift = cvPoint2D32f(0.f, 0.f);
+	response = 0.;
+}
+
+char GlobalMotion::estimate(const ImagePyramid &previous, const ImagePyramid &current){
+	CVFLOW_TASK("globalMotion");
+	reset();
+	if(!previous.sameSize(current)){
+		strcpy_s(error, 255, "GlobalMotion::estimate failed: pyramids do not match");
+		return 0;
+	}
+
+	//Coarsest level needed to get under maxWidth
+	const vector<cv::Mat> &p = previous.getLevels();
+	const vector<cv::Mat> &c = current.getLevels();
+	int level = 0, maxLevel = MIN(previous.getMaxLevel(), current.getMaxLevel());
+	while((level < maxLevel)&&(p[level*2].cols > maxWidth))level++;
+	const cv::Mat &a = p[level*2], &b = c[level*2];
+	if((a.cols < 2)||(a.rows < 2))return 1;
+
+	try{
+		//The window and both float levels are kept from frame to frame and
+		//only reallocated when the level size changes
+		const uchar *storage = window.datastart;
+		if(window.size() != a.size())cv::createHanningWindow(window, a.size(), CV_32F);
+		if(window.datastart != storage)allocations++;
+		storage = previousLevel.datastart;
+		a.convertTo(previousLevel, CV_32F);
+		if(previousLevel.datastart != storage)allocations++;
+		storage = currentLevel.datastart;
+		b.convertTo(currentLevel, CV_32F);
+		if(currentLevel.datastart != storage)allocations++;
+
+		//Allocates its DFT buffers internally, on every call
+		cv::Point2d d = cv::phaseCorrelate(previousLevel, currentLevel, window, &response);
+		if(response < minResponse)return 1;
+		//Levels are half the size of the one below, rounded up
+		shift.x = (float)(d.x * (double)p[0].cols / (double)a.cols);
+		shift.y = (float)(d.y * (double)p[0].rows / (double)a.rows);
+	}
+	catch(cv::Exception &e){
+		strcpy_s(error, 255, e.what());
+		return 0;
+	}
+	return 1;
+}
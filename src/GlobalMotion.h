@@ -0,0 +1,50 @@
+#ifndef _GLOBALMOTION_H_
+#define _GLOBALMOTION_H_
+
+#include "opencv.hpp"
+#include "Portability.h"
+#include "ImagePyramid.h"
+
+/*Translation of the whole image between two frames, estimated by phase
+  correlation on a coarse level of their pyramids. When the camera pans,
+  it gives LK a starting point close to every feature's actual motion.*/
+class GlobalMotion{
+	private:
+		cv::Mat previousLevel;	//Float copies of the levels used
+		cv::Mat currentLevel;
+		cv::Mat window;			//Hanning window of the same size
+		CvPoint2D32f shift;
+		double response;
+		double minResponse;
+		int maxWidth;
+		unsigned int allocations;
+		char error[256];
+
+	public:
+		GlobalMotion();
+		~GlobalMotion(){;}
+
+		/*Estimates the shift from previous to current, in level 0 pixels.
+		  The shift is 0 if the correlation peak is weaker than minResponse.
+		  cv::phaseCorrelate allocates its DFT buffers on every call, which
+		  getAllocationCount() does not include.*/
+		char estimate(const ImagePyramid &previous, const ImagePyramid &current);
+		void reset();
+
+		CvPoint2D32f getShift(){return shift;}
+		double getResponse(){return response;}
+
+		void setMinResponse(double r){minResponse = r < 0. ? 0. : r;}
+		double getMinResponse(){return minResponse;}
+
+		//The first level at most this wide is used
+		void setMaxWidth(int w){maxWidth = w < 16 ? 16 : w;}
+		int getMaxWidth(){return maxWidth;}
+
+		//Number of times the window or level copies had to be (re)allocated
+		unsigned int getAllocationCount(){return allocations;}
+
+		const char* getErrorMess(){return error;}
+};
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef _GROWARRAY_H_
+#define _GROWARRAY_H_
+
+#include <stdlib.h>
+
+/*Helpers for buffers that only ever grow. Once a buffer has reached its
+  working size it is reused from frame to frame and the per-frame loop no
+  longer touches the heap.*/
+
+/*Reallocates *p to hold n elements. *p is left untouched on failure.*/
+template<typename T>
+static inline char growArray(T **p, unsigned int n){
+	T *tmp = (T*)realloc(*p, sizeof(T)*n);
+	if(!tmp)return 0;
+	*p = tmp;
+	return 1;
+}
+
+/*New capacity for a buffer that must hold n elements: at least double the
+  current one, so that slowly rising counts settle after a few frames.*/
+static inline unsigned int growCapacity(unsigned int capacity, unsigned int n){
+	unsigned int c = capacity * 2;
+	if(c < 16)c = 16;
+	return c > n ? c : n;
+}
+
+#endif
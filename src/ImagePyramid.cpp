@@ -0,0 +1,296 @@
+#include "ImagePyramid.h"
+#include "SimdIntrinsics.h"
+#include "Profiling.h"
+
+#include <string.h>
+
+/****Kernels****/
+
+//Same as cv::borderInterpolate with BORDER_REFLECT_101
+static inline int reflect101(int p, int len){
+	if(len == 1)return 0;
+	while((unsigned)p >= (unsigned)len)p = p < 0 ? -p : 2*(len - 1) - p;
+	return p;
+}
+
+//Horizontal 1-4-6-4-1 filter of one source row, decimated by 2 (the first
+//pass of cv::pyrDown). The results fit in 16 bits.
+static void pyrDownRow(const uchar *src, int sw, ushort *dst, int dw){
+	int x = 0, c;
+
+	//Left border
+	for(;(x<dw)&&(x<1);x++){
+		c = 2*x;
+		dst[x] = (ushort)(src[reflect101(c-2, sw)] + src[reflect101(c+2, sw)] +
+			4*(src[reflect101(c-1, sw)] + src[reflect101(c+1, sw)]) + 6*src[c]);
+	}
+#if CV_SIMD128
+	//16 outputs read source bytes 2x-2 to 2x+33
+	for(;(x+16<=dw)&&(2*x+33<sw);x+=16){
+		cv::v_uint8x16 e0, o0, e1, o1, e2, o2;
+		cv::v_uint16x8 e0l, e0h, o0l, o0h, e1l, e1h, o1l, o1h, e2l, e2h;
+		cv::v_load_deinterleave(src + 2*x - 2, e0, o0);
+		cv::v_load_deinterleave(src + 2*x, e1, o1);
+		cv::v_load_deinterleave(src + 2*x + 2, e2, o2);
+		cv::v_expand(e0, e0l, e0h); cv::v_expand(o0, o0l, o0h);
+		cv::v_expand(e1, e1l, e1h); cv::v_expand(o1, o1l, o1h);
+		cv::v_expand(e2, e2l, e2h);
+		cv::v_store(dst + x, e0l + e2l + ((o0l + o1l) << 2) + (e1l << 2) + (e1l << 1));
+		cv::v_store(dst + x + 8, e0h + e2h + ((o0h + o1h) << 2) + (e1h << 2) + (e1h << 1));
+	}
+#endif
+	for(;x<dw;x++){
+		c = 2*x;
+		if(c + 2 < sw)dst[x] = (ushort)(src[c-2] + src[c+2] + 4*(src[c-1] + src[c+1]) + 6*src[c]);
+		else dst[x] = (ushort)(src[c-2] + src[reflect101(c+2, sw)] +
+			4*(src[c-1] + src[reflect101(c+1, sw)]) + 6*src[c]);
+	}
+}
+
+//Vertical 1-4-6-4-1 filter of five filtered rows, rounded as cv::pyrDown does
+static void pyrDownColumn(const ushort *r0, const ushort *r1, const ushort *r2, const ushort *r3, const ushort *r4, uchar *dst, int dw){
+	int x = 0;
+#if CV_SIMD128
+	for(;x+16<=dw;x+=16){
+		cv::v_uint16x8 a = cv::v_load(r0 + x) + cv::v_load(r4 + x) + ((cv::v_load(r1 + x) + cv::v_load(r3 + x)) << 2) +
+			(cv::v_load(r2 + x) << 2) + (cv::v_load(r2 + x) << 1);
+		cv::v_uint16x8 b = cv::v_load(r0 + x + 8) + cv::v_load(r4 + x + 8) + ((cv::v_load(r1 + x + 8) + cv::v_load(r3 + x + 8)) << 2) +
+			(cv::v_load(r2 + x + 8) << 2) + (cv::v_load(r2 + x + 8) << 1);
+		cv::v_store(dst + x, cv::v_rshr_pack<8>(a, b));
+	}
+#endif
+	for(;x<dw;x++)dst[x] = (uchar)((r0[x] + r4[x] + 4*(r1[x] + r3[x]) + 6*r2[x] + 128) >> 8);
+}
+
+/*Scharr derivatives of row s1, interleaved (dx, dy) as 16-bit pairs, with
+  the arithmetic and borders of calcOpticalFlowPyrLK's own calcSharrDeriv.
+  trow0 and trow1 need one element of room on each side.*/
+static void scharrRow(const uchar *s0, const uchar *s1, const uchar *s2, int w, short *trow0, short *trow1, short *drow){
+	int x = 0;
+#if CV_SIMD128
+	for(;x+8<=w;x+=8){
+		cv::v_int16x8 a = cv::v_reinterpret_as_s16(cv::v_load_expand(s0 + x));
+		cv::v_int16x8 b = cv::v_reinterpret_as_s16(cv::v_load_expand(s1 + x));
+		cv::v_int16x8 c = cv::v_reinterpret_as_s16(cv::v_load_expand(s2 + x));
+		cv::v_int16x8 ac = a + c;
+		cv::v_store(trow0 + x, ac + (ac << 1) + (b << 3) + (b << 1));
+		cv::v_store(trow1 + x, c - a);
+	}
+#endif
+	for(;x<w;x++){
+		trow0[x] = (short)((s0[x] + s2[x])*3 + s1[x]*10);
+		trow1[x] = (short)(s2[x] - s0[x]);
+	}
+
+	int x0 = w > 1 ? 1 : 0, x1 = w > 1 ? w - 2 : 0;
+	trow0[-1] = trow0[x0]; trow0[w] = trow0[x1];
+	trow1[-1] = trow1[x0]; trow1[w] = trow1[x1];
+
+	x = 0;
+#if CV_SIMD128
+	for(;x+8<=w;x+=8){
+		cv::v_int16x8 dx = cv::v_load(trow0 + x + 1) - cv::v_load(trow0 + x - 1);
+		cv::v_int16x8 l = cv::v_load(trow1 + x - 1) + cv::v_load(trow1 + x + 1), m = cv::v_load(trow1 + x);
+		cv::v_int16x8 dy = l + (l << 1) + (m << 3) + (m << 1);
+		cv::v_store_interleave(drow + 2*x, dx, dy);
+	}
+#endif
+	for(;x<w;x++){
+		drow[2*x] = (short)(trow0[x+1] - trow0[x-1]);
+		drow[2*x+1] = (short)((trow1[x+1] + trow1[x-1])*3 + trow1[x]*10);
+	}
+}
+
+//Fills the horizontal border of one padded row
+static inline void padRow(uchar *row, int w, int pad){
+	for(int k=1;k<=pad;k++){
+		row[-k] = row[reflect101(-k, w)];
+		row[w-1+k] = row[reflect101(w-1+k, w)];
+	}
+}
+
+
+/****ImagePyramid****/
+
+ImagePyramid::ImagePyramid(){
+	window = cvSize(0, 0);
+	depth = 0;
+	maxLevel = 0;
+	valid = false;
+	allocations = 0;
+	error[0] = 0;
+}
+
+bool ImagePyramid::sameSize(const ImagePyramid &p) const{
+	return valid && p.valid && (header.rows == p.header.rows) && (header.cols == p.header.cols);
+}
+
+bool ImagePyramid::fits(CvSize w, int l) const{
+	return valid && (w.width <= window.width) && (w.height <= window.height) && (l <= depth);
+}
+
+//Derivatives of row y of a level, once rows up to y+1 are available
+void ImagePyramid::derivativeRow(int level, int y){
+	const cv::Mat &img = levels[level*2];
+	cv::Mat &d = levels[level*2+1];
+	scharrRow(img.ptr<uchar>(reflect101(y-1, img.rows)), img.ptr<uchar>(y), img.ptr<uchar>(reflect101(y+1, img.rows)),
+		img.cols, &derivBuffer[1], &derivBuffer[img.cols + 3], d.ptr<short>(y));
+}
+
+/*Each level is produced in a single pass: every output row is written
+  with its horizontal border, then the derivatives of the row above are
+  computed while both are still in cache. Source rows are filtered
+  horizontally once into a ring of five rows.*/
+void ImagePyramid::buildLevel(int level){
+	const cv::Mat &src = levels[level*2-2];
+	cv::Mat &dst = levels[level*2];
+	int sw = src.cols, sh = src.rows, dw = dst.cols, dh = dst.rows;
+	int tags[5] = {-1, -1, -1, -1, -1};
+	const ushort *r[5];
+	int x, y, k, sy;
+
+	for(y=0;y<dh;y++){
+		for(k=0;k<5;k++){
+			sy = reflect101(2*y - 2 + k, sh);
+			x = sy % 5;
+			if(tags[x] != sy){
+				pyrDownRow(src.ptr<uchar>(sy), sw, &rowBuffer[x*dw], dw);
+				tags[x] = sy;
+			}
+			r[k] = &rowBuffer[x*dw];
+		}
+		uchar *out = dst.ptr<uchar>(y);
+		pyrDownColumn(r[0], r[1], r[2], r[3], r[4], out, dw);
+		padRow(out, dw, window.width);
+		if(y > 0)derivativeRow(level, y - 1);
+	}
+	derivativeRow(level, dh - 1);
+}
+
+void ImagePyramid::padLevel(int level){
+	cv::Mat &img = levels[level*2];
+	int k, w = img.cols + 2*window.width;
+	for(k=1;k<=window.height;k++){
+		memcpy(img.ptr<uchar>(0) - k*img.step - window.width, img.ptr<uchar>(reflect101(-k, img.rows)) - window.width, w);
+		memcpy(img.ptr<uchar>(img.rows - 1) + k*img.step - window.width, img.ptr<uchar>(reflect101(img.rows - 1 + k, img.rows)) - window.width, w);
+	}
+}
+
+char ImagePyramid::build(CvMat *image, CvSize w, int l){
+	CVFLOW_TASK("pyramid");
+#ifdef CVFLOW_FUSED_PYRAMID
+	return buildFused(image, w, l);
+#else
+	return buildWithOpenCV(image, w, l);
+#endif
+}
+
+char ImagePyramid::buildFused(CvMat *image, CvSize w, int l){
+	if((!image)||(CV_MAT_TYPE(image->type) != CV_8UC1)){
+		strcpy_s(error, 255, "ImagePyramid::buildFused failed: input must be 8-bit, 1 plane");
+		valid = false;
+		return 0;
+	}
+	if((w.width < 3)||(w.height < 3)){
+		strcpy_s(error, 255, "ImagePyramid::buildFused failed: window must be at least 3x3");
+		valid = false;
+		return 0;
+	}
+	if(l < 0)l = 0;
+	window = w;
+	depth = l;
+
+	//Same number of levels as cv::buildOpticalFlowPyramid
+	int level, y, cols = image->cols, rows = image->rows;
+	for(maxLevel=0;maxLevel<l;maxLevel++){
+		cols = (cols + 1) / 2;
+		rows = (rows + 1) / 2;
+		if((cols <= w.width)||(rows <= w.height))break;
+	}
+
+	try{
+		size_t count = (size_t)(maxLevel + 1);
+		if(images.size() != count){
+			images.resize(count);
+			derivs.resize(count);
+			levels.resize(count*2);
+		}
+		cols = image->cols;
+		rows = image->rows;
+		for(level=0;level<=maxLevel;level++){
+			const uchar *storage = images[level].datastart;
+			images[level].create(rows + 2*w.height, cols + 2*w.width, CV_8UC1);
+			if(images[level].datastart != storage)allocations++;
+			storage = derivs[level].datastart;
+			derivs[level].create(rows + 2*w.height, cols + 2*w.width, CV_16SC2);
+			if(derivs[level].datastart != storage){
+				//LK reads zeros outside of the image, and the border is never written
+				derivs[level] = cv::Scalar::all(0);
+				allocations++;
+			}
+			cv::Rect roi(w.width, w.height, cols, rows);
+			levels[level*2] = images[level](roi);
+			levels[level*2+1] = derivs[level](roi);
+			cols = (cols + 1) / 2;
+			rows = (rows + 1) / 2;
+		}
+		if(rowBuffer.size() < (size_t)(5*((image->cols + 1) / 2))){
+			rowBuffer.resize(5*((image->cols + 1) / 2));
+			allocations++;
+		}
+		if(derivBuffer.size() < (size_t)(2*(image->cols + 2))){
+			derivBuffer.resize(2*(image->cols + 2));
+			allocations++;
+		}
+	}
+	catch(cv::Exception &e){
+		strcpy_s(error, 255, e.what());
+		valid = false;
+		return 0;
+	}
+
+	//Level 0 is a copy of the input
+	cv::Mat &base = levels[0];
+	for(y=0;y<image->rows;y++){
+		uchar *out = base.ptr<uchar>(y);
+		memcpy(out, image->data.ptr + y*image->step, image->cols);
+		padRow(out, image->cols, w.width);
+		if(y > 0)derivativeRow(0, y - 1);
+	}
+	derivativeRow(0, image->rows - 1);
+	padLevel(0);
+
+	for(level=1;level<=maxLevel;level++){
+		buildLevel(level);
+		padLevel(level);
+	}
+
+	cvInitMatHeader(&header, levels[0].rows, levels[0].cols, CV_8UC1, levels[0].data, levels[0].step);
+	valid = true;
+	return 1;
+}
+
+char ImagePyramid::buildWithOpenCV(CvMat *image, CvSize w, int l){
+	if((!image)||(CV_MAT_TYPE(image->type) != CV_8UC1)){
+		strcpy_s(error, 255, "ImagePyramid::buildWithOpenCV failed: input must be 8-bit, 1 plane");
+		valid = false;
+		return 0;
+	}
+	try{
+		maxLevel = cv::buildOpticalFlowPyramid(cv::cvarrToMat(image), levels, cv::Size(w.width, w.height), l,
+			true, cv::BORDER_REFLECT_101, cv::BORDER_CONSTANT, false);
+	}
+	catch(cv::Exception &e){
+		strcpy_s(error, 255, e.what());
+		valid = false;
+		return 0;
+	}
+	//The levels no longer point into our own storage
+	images.clear();
+	derivs.clear();
+	cvInitMatHeader(&header, levels[0].rows, levels[0].cols, CV_8UC1, levels[0].data, levels[0].step);
+	window = w;
+	depth = l;
+	valid = true;
+	return 1;
+}
@@ -0,0 +1,69 @@
+#ifndef _IMAGEPYRAMID_H_
+#define _IMAGEPYRAMID_H_
+
+#include "opencv.hpp"
+#include "Portability.h"
+#include <vector>
+
+using namespace std;
+
+/*Image pyramid in the layout cv::calcOpticalFlowPyrLK expects: for each
+  level, the padded image followed by its Scharr derivatives. Level 0 holds
+  a copy of the frame it was built from, so once built the pyramid can
+  stand in for that frame. Storage is reused from one build to the next.
+  build() uses cv::buildOpticalFlowPyramid unless the library is compiled
+  with CVFLOW_FUSED_PYRAMID, in which case it uses buildFused(): levels and
+  derivatives built together in one pass over each level with SIMD kernels.
+  "cvflow_bench -checkpyramid 1" checks that the two match.*/
+class ImagePyramid{
+	private:
+		vector<cv::Mat> levels;
+		vector<cv::Mat> images;		//Padded storage behind levels
+		vector<cv::Mat> derivs;
+		vector<ushort> rowBuffer;	//Ring of horizontally filtered rows
+		vector<short> derivBuffer;	//Vertical Scharr passes
+		CvMat header;
+		CvSize window;
+		int depth;
+		int maxLevel;
+		bool valid;
+		unsigned int allocations;
+		char error[256];
+
+		void derivativeRow(int level, int y);
+		void buildLevel(int level);
+		void padLevel(int level);
+
+	public:
+		ImagePyramid();
+		~ImagePyramid(){;}
+
+		/*Builds the pyramid of an 8-bit, 1 plane image, padded for LK
+		  windows up to window and with up to maxLevel levels above 0.*/
+		char build(CvMat *image, CvSize window, int maxLevel);
+		//Same, with the fused SIMD kernels
+		char buildFused(CvMat *image, CvSize window, int maxLevel);
+		//Same, with cv::buildOpticalFlowPyramid
+		char buildWithOpenCV(CvMat *image, CvSize window, int maxLevel);
+
+		bool isValid() const {return valid;}
+		void invalidate(){valid = false;}
+
+		//True if both pyramids were built from images of the same size
+		bool sameSize(const ImagePyramid &p) const;
+		//True if the pyramid can be used with the given window and depth
+		bool fits(CvSize w, int l) const;
+
+		//Level 0 as a header, NULL if the pyramid was not built
+		CvMat* getImage(){return valid ? &header : 0;}
+		const vector<cv::Mat>& getLevels() const {return levels;}
+		//Levels actually built, may be fewer than requested for small images
+		int getMaxLevel() const {return maxLevel;}
+
+		//Number of times the pyramid storage had to be (re)allocated
+		unsigned int getAllocationCount() const {return allocations;}
+
+		const char* getErrorMess(){return error;}
+};
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef _LATENCYATOMS_H_
+#define _LATENCYATOMS_H_
+
+#include "LatencyHistogram.h"
+
+/*Latency summaries as Max atoms, for the getlatency messages of the
+  cv.jit.flow and cv.jit.flowfield externals. Needs the Max headers.*/
+
+#define LATENCY_ATOM_COUNT 7
+
+//Fills a with "<name> <frames> <p50> <p95> <p99> <max> <mean>", in milliseconds
+static void latencyToAtoms(const char *name, const LatencyHistogram *h, t_atom *a)
+{
+	atom_setsym(a, gensym((char *)name));
+	atom_setlong(a+1, h->count);
+	atom_setfloat(a+2, h->getPercentile(0.5));
+	atom_setfloat(a+3, h->getPercentile(0.95));
+	atom_setfloat(a+4, h->getPercentile(0.99));
+	atom_setfloat(a+5, h->max);
+	atom_setfloat(a+6, h->getMean());
+}
+
+#endif
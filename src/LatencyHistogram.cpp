@@ -0,0 +1,68 @@
+#include "LatencyHistogram.h"
+
+#include <math.h>
+#include <string.h>
+
+int LatencyHistogram::getBucket(double ms){
+	double us = ms * 1000.;
+	int e;
+	
+	if(!(us >= 1.))return 0;	//Also catches NaN
+	double m = frexp(us, &e);	//us = m * 2^e, m in [0.5, 1)
+	int octave = e - 1;
+	if(octave >= LATENCY_OCTAVES)return LATENCY_BUCKETS - 1;
+	int sub = (int)((m * 2. - 1.) * LATENCY_SUBBUCKETS);
+	if(sub >= LATENCY_SUBBUCKETS)sub = LATENCY_SUBBUCKETS - 1;
+	return 1 + octave * LATENCY_SUBBUCKETS + sub;
+}
+
+double LatencyHistogram::getLowerBound(int bucket){
+	if(bucket <= 0)return 0.;
+	if(bucket >= LATENCY_BUCKETS - 1)return ldexp(1., LATENCY_OCTAVES) * 0.001;
+	bucket--;
+	int octave = bucket / LATENCY_SUBBUCKETS;
+	int sub = bucket % LATENCY_SUBBUCKETS;
+	return ldexp(1. + (double)sub / LATENCY_SUBBUCKETS, octave) * 0.001;
+}
+
+double LatencyHistogram::getUpperBound(int bucket){
+	if(bucket >= LATENCY_BUCKETS - 1)return HUGE_VAL;
+	return getLowerBound(bucket + 1);
+}
+
+void LatencyHistogram::add(double ms){
+	counts[getBucket(ms)]++;
+	if(!count || (ms < min))min = ms;
+	if(!count || (ms > max))max = ms;
+	sum += ms;
+	count++;
+}
+
+void LatencyHistogram::reset(){
+	memset(counts, 0, sizeof(counts));
+	count = 0;
+	sum = min = max = 0.;
+}
+
+double LatencyHistogram::getPercentile(double p) const{
+	if(!count)return 0.;
+	if(p <= 0.)return min;
+	if(p >= 1.)return max;
+	
+	//Rank of the sample we want, 1-based
+	unsigned int rank = (unsigned int)ceil(p * count);
+	unsigned int seen = 0;
+	int i;
+	for(i=0;i<LATENCY_BUCKETS;i++){
+		seen += counts[i];
+		if(seen >= rank)break;
+	}
+	if(i >= LATENCY_BUCKETS - 1)return max;
+	
+	//Geometric middle of the bucket, but never outside what was measured
+	double lo = getLowerBound(i);
+	double v = i ? sqrt(lo * getUpperBound(i)) : lo;
+	if(v < min)v = min;
+	if(v > max)v = max;
+	return v;
+}
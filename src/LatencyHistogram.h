@@ -0,0 +1,35 @@
+#ifndef _LATENCYHISTOGRAM_H_
+#define _LATENCYHISTOGRAM_H_
+
+#define LATENCY_OCTAVES 24		//1 us to ~16 s
+#define LATENCY_SUBBUCKETS 8	//Buckets per octave, ~9% wide
+#define LATENCY_BUCKETS (LATENCY_OCTAVES * LATENCY_SUBBUCKETS + 2)	//Plus underflow and overflow
+
+/*Latencies in milliseconds, counted in logarithmic buckets so that the
+  memory used stays the same over runs of any length. Percentiles are
+  accurate to about 5%, the minimum and maximum are exact.*/
+class LatencyHistogram{
+	public:
+		unsigned int counts[LATENCY_BUCKETS];
+		unsigned int count;
+		double sum;
+		double min;
+		double max;
+
+		LatencyHistogram(){reset();}
+		~LatencyHistogram(){;}
+
+		void add(double ms);
+		void reset();
+
+		//p in [0, 1]; 0 when nothing has been added
+		double getPercentile(double p) const;
+		double getMean() const {return count ? sum / count : 0.;}
+
+		static int getBucket(double ms);
+		//Range of a bucket in milliseconds
+		static double getLowerBound(int bucket);
+		static double getUpperBound(int bucket);
+};
+
+#endif
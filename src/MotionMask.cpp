@@ -0,0 +1,149 @@
+#include "MotionMask.h"
+#include "SimdIntrinsics.h"
+#include "GrowArray.h"
+#include "Profiling.h"
+
+#include <string.h>
+
+/****Kernels****/
+
+//255 where |a - b| > t, as cvAbsDiff followed by cvThreshold(CV_THRESH_BINARY)
+static void thresholdDiffRow(const uchar *a, const uchar *b, uchar *dst, int w, uchar t){
+	int x = 0;
+#if CV_SIMD128
+	cv::v_uint8x16 vt = cv::v_setall_u8(t);
+	for(;x+16<=w;x+=16)cv::v_store(dst + x, cv::v_absdiff(cv::v_load(a + x), cv::v_load(b + x)) > vt);
+#endif
+	for(;x<w;x++)dst[x] = (uchar)((a[x] > b[x] ? a[x] - b[x] : b[x] - a[x]) > t ? 255 : 0);
+}
+
+//Maximum over [x-r, x+r]. src needs r bytes of zeros on each side.
+static void dilateRow(const uchar *src, uchar *dst, int w, int r){
+	int x = 0, k;
+#if CV_SIMD128
+	for(;x+16<=w;x+=16){
+		cv::v_uint8x16 m = cv::v_load(src + x);
+		for(k=1;k<=r;k++)m = cv::v_max(m, cv::v_max(cv::v_load(src + x - k), cv::v_load(src + x + k)));
+		cv::v_store(dst + x, m);
+	}
+#endif
+	for(;x<w;x++){
+		uchar m = src[x];
+		for(k=1;k<=r;k++){
+			if(src[x-k] > m)m = src[x-k];
+			if(src[x+k] > m)m = src[x+k];
+		}
+		dst[x] = m;
+	}
+}
+
+//Maximum of n rows
+static void maxRows(const uchar *const *rows, int n, uchar *dst, int w){
+	int x = 0, i;
+#if CV_SIMD128
+	for(;x+16<=w;x+=16){
+		cv::v_uint8x16 m = cv::v_load(rows[0] + x);
+		for(i=1;i<n;i++)m = cv::v_max(m, cv::v_load(rows[i] + x));
+		cv::v_store(dst + x, m);
+	}
+#endif
+	for(;x<w;x++){
+		uchar m = rows[0][x];
+		for(i=1;i<n;i++)if(rows[i][x] > m)m = rows[i][x];
+		dst[x] = m;
+	}
+}
+
+/****MotionMask****/
+
+MotionMask::MotionMask(){
+	buffer = 0;
+	capacity = 0;
+	allocations = 0;
+	error[0] = 0;
+}
+
+MotionMask::~MotionMask(){
+	free(buffer);
+}
+
+char MotionMask::reserve(unsigned int n){
+	if(n <= capacity)return 1;
+	if(!growArray(&buffer, n)){strcpy_s(error, 255, "MotionMask::reserve failed"); return 0;}
+	capacity = n;
+	allocations++;
+	return 1;
+}
+
+static char checkImages(CvMat *current, CvMat *previous, CvMat *mask){
+	if((!current)||(!previous)||(!mask))return 0;
+	if((CV_MAT_TYPE(current->type) != CV_8UC1)||(CV_MAT_TYPE(previous->type) != CV_8UC1)||(CV_MAT_TYPE(mask->type) != CV_8UC1))return 0;
+	return CV_ARE_SIZES_EQ(current, previous) && CV_ARE_SIZES_EQ(current, mask);
+}
+
+char MotionMask::compute(CvMat *current, CvMat *previous, CvMat *mask, int threshold, int radius){
+	CVFLOW_TASK("motionMask");
+	const uchar *rows[2*MOTIONMASK_MAX_RADIUS+1];
+	int w, h, y, out, n, i;
+	uchar t;
+
+	if(!checkImages(current, previous, mask)){
+		strcpy_s(error, 255, "MotionMask::compute failed: images must be 8-bit, 1 plane and of the same size");
+		return 0;
+	}
+	w = current->cols;
+	h = current->rows;
+	t = (uchar)(threshold < 0 ? 0 : (threshold > 255 ? 255 : threshold));
+	radius = radius < 0 ? 0 : (radius > MOTIONMASK_MAX_RADIUS ? MOTIONMASK_MAX_RADIUS : radius);
+
+	if(radius == 0){
+		for(y=0;y<h;y++)thresholdDiffRow(current->data.ptr + y*current->step, previous->data.ptr + y*previous->step,
+			mask->data.ptr + y*mask->step, w, t);
+		return 1;
+	}
+
+	//Difference row with radius zeros on each side, then a ring of
+	//2*radius+1 horizontally dilated rows
+	n = 2*radius + 1;
+	if(!reserve((unsigned int)(w + 2*radius + n*w)))return 0;
+	uchar *diff = buffer + radius;
+	uchar *ring = buffer + w + 2*radius;
+	memset(buffer, 0, radius);
+	memset(diff + w, 0, radius);
+
+	//Row y enters the ring, row y - radius is complete
+	for(y=0;y<h+radius;y++){
+		if(y < h){
+			thresholdDiffRow(current->data.ptr + y*current->step, previous->data.ptr + y*previous->step, diff, w, t);
+			dilateRow(diff, ring + (y % n)*w, w, radius);
+		}
+		out = y - radius;
+		if(out < 0)continue;
+		int first = out - radius < 0 ? 0 : out - radius;
+		int last = out + radius >= h ? h - 1 : out + radius;
+		for(i=first;i<=last;i++)rows[i - first] = ring + (i % n)*w;
+		maxRows(rows, last - first + 1, mask->data.ptr + out*mask->step, w);
+	}
+	return 1;
+}
+
+char MotionMask::computeWithOpenCV(CvMat *current, CvMat *previous, CvMat *mask, int threshold, int radius){
+	if(!checkImages(current, previous, mask)){
+		strcpy_s(error, 255, "MotionMask::computeWithOpenCV failed: images must be 8-bit, 1 plane and of the same size");
+		return 0;
+	}
+	radius = radius < 0 ? 0 : (radius > MOTIONMASK_MAX_RADIUS ? MOTIONMASK_MAX_RADIUS : radius);
+	try{
+		cvAbsDiff(current, previous, mask);
+		cvThreshold(mask, mask, threshold, 255, CV_THRESH_BINARY);
+		if(radius > 0){
+			cv::Mat m = cv::cvarrToMat(mask);
+			cv::dilate(m, m, cv::getStructuringElement(cv::MORPH_RECT, cv::Size(2*radius + 1, 2*radius + 1)));
+		}
+	}
+	catch(cv::Exception &e){
+		strcpy_s(error, 255, e.what());
+		return 0;
+	}
+	return 1;
+}
@@ -0,0 +1,36 @@
+#ifndef _MOTIONMASK_H_
+#define _MOTIONMASK_H_
+
+#include "opencv.hpp"
+#include "Portability.h"
+
+#define MOTIONMASK_MAX_RADIUS 8
+
+/*Binary mask of the pixels that changed between two frames: 255 where
+  |current - previous| > threshold, 0 elsewhere, optionally dilated by a
+  (2*radius+1) square to close small holes. Differencing, thresholding
+  and dilation are fused into one pass over the frames; dilation only
+  keeps a few rows in flight, in a buffer that is reused between frames.*/
+class MotionMask{
+	private:
+		uchar *buffer;			//Padded difference row, then 2*radius+1 dilated rows
+		unsigned int capacity;
+		unsigned int allocations;
+		char error[256];
+
+		char reserve(unsigned int n);
+
+	public:
+		MotionMask();
+		~MotionMask();
+
+		//All three must be 8-bit, 1 plane and of the same size
+		char compute(CvMat *current, CvMat *previous, CvMat *mask, int threshold, int radius);
+		//Same result with cvAbsDiff, cvThreshold and cv::dilate, for testing
+		char computeWithOpenCV(CvMat *current, CvMat *previous, CvMat *mask, int threshold, int radius);
+
+		unsigned int getAllocationCount() const {return allocations;}
+		const char* getErrorMess(){return error;}
+};
+
+#endif
@@ -1,86 +1,125 @@
 #include "OpticalFlowTracker.h"
+#include "GrowArray.h"
+#include "Profiling.h"
+
+static const char *const trackerStageNames[TRACKER_STAGE_COUNT] = {
+	"pyramid", "findFeatures", "updateFeatureList", "trackFeatures", "calculateVectors", "findFriends", "processFrame"
+};
 
 
 /*******************************Constructor/Destructor*********************************/
 OpticalFlowTracker::OpticalFlowTracker(){
 	currentImage = 0;
-	previousImage = 0;
-	currentPyramid = 0;
-	previousPyramid = 0;
-	vectors = 0;
+	currentPyramid = &pyramids[0];
+	previousPyramid = &pyramids[1];
 	features = 0;
 	newPositions = 0;
 	dummyPoint = cvPoint2D32f(0.f,0.f);
 	status = 0;
+	fbErrors = 0;
+	backPoints = 0;
+	traceId = TraceRecorder::get().newInstance("cv.jit.flow");
+	publishTelemetry = false;
+	frameIndex = 0;
+	backStatus = 0;
 	indices = 0;
+	ages = 0;
+	velocities = 0;
+	tempFeatures = 0;
+	tempIndices = 0;
+	tempAges = 0;
+	tempVelocities = 0;
+	detected = 0;
+	detectedStatus = 0;
+	detectedCapacity = 0;
+	framesSinceDetection = 0;
+	featureCapacity = 0;
+	tempCapacity = 0;
+	trackCapacity = 0;
+	allocations = 0;
 	dummyChar = 0;
 	featureCount = 0;
 	windowSize = cvSize(10,10);
 	pyramidLevels = 3;
 	flags = 0;
+	predict = false;
+	useGlobalMotion = false;
+	fbCheck = false;
+	asyncDetection = false;
+	fbThreshold = 1.f;
 	minDistance = 0.01f;
+	detectorThreshold = 0.01f;
+	detectionInterval = 1;
+	maxFeatures = MAX_EIG_FEATURE_COUNT;
+	maxIterations = 20;
 	vectorCount = 0;
 	goodVectorCount = 0;
 	maxAge = 3;
 	maxFriends = 0;
-	dummyVector.x = -1000.f;
-	dummyVector.y = -1000.f;
-	dummyVector.x2 = -1000.f;
-	dummyVector.y2 = -1000.f;
-	dummyVector.alpha = -1000.f;
-	dummyVector.theta = -1000.f;
-	dummyVector.friends = 0;
-	dummyVector.age = 0;
+	error[0] = 0;
 	
 	featureDetector.setMinDistance(minDistance);
-	featureDetector.setThreshold(0.01f);
+	featureDetector.setThreshold(detectorThreshold);
+	stats.setStages(trackerStageNames, TRACKER_STAGE_COUNT);
 }
 
 OpticalFlowTracker::~OpticalFlowTracker(){
-	if(previousImage)cvReleaseMat(&previousImage);
-	if(currentPyramid)cvReleaseMat(&currentPyramid);
-	if(previousPyramid)cvReleaseMat(&previousPyramid);
-	
 	free(status);
+	free(fbErrors);
+	free(backPoints);
+	free(backStatus);
+	free(features);
 	free(newPositions);
 	free(indices);
+	free(ages);
+	free(velocities);
+	free(tempFeatures);
+	free(tempIndices);
+	free(tempAges);
+	free(tempVelocities);
+	free(detected);
+	free(detectedStatus);
 }
 
 
 /*******************************Private methods*********************************/
 
-char OpticalFlowTracker::rebuildImages(){
-	if(previousImage)cvReleaseMat(&previousImage);
-		if(currentPyramid)cvReleaseMat(&currentPyramid);
-		if(previousPyramid)cvReleaseMat(&previousPyramid);
-		flags = 0;
-		previousImage = cvCreateMat(currentImage->rows, currentImage->cols, currentImage->type);
-		currentPyramid = cvCreateMat(currentImage->rows, currentImage->cols, currentImage->type);
-		previousPyramid = cvCreateMat(currentImage->rows, currentImage->cols, currentImage->type);
-		if((!previousImage)||(!currentPyramid)||(!previousPyramid)){
-			if(previousImage)cvReleaseMat(&previousImage);
-			if(currentPyramid)cvReleaseMat(&currentPyramid);
-			if(previousPyramid)cvReleaseMat(&previousPyramid);
-
-			strcpy_s(error, 255, "OpticalFlowTracker::rebuildImages failed");
-			return 0;
-		}
-		return 1;
+void OpticalFlowTracker::clearTracks(){
+	vectors.count = 0;
+	indexManager.reset();
+	featureCount = 0;
+	vectorCount = 0;
+	goodVectorCount = 0;
 }
 
-char OpticalFlowTracker::checkImages(){
-	if(!currentImage){strcpy_s(error, 255, "OpticalFlowTracker::checkImages failed");return 0;}
-	if((!previousImage)||(!currentPyramid)||(!previousPyramid))return rebuildImages();
-	if(!CV_ARE_SIZES_EQ(previousImage, currentImage))return rebuildImages();
+//The merged feature list is built in the temp lists, which are then swapped
+//with the current ones, so both only grow and are reused across frames.
+char OpticalFlowTracker::reserveTempLists(unsigned int n){
+	if(n <= tempCapacity)return 1;
+	n = growCapacity(tempCapacity, n);
+	if(!growArray(&tempFeatures, n) || !growArray(&tempIndices, n) || !growArray(&tempAges, n) ||
+		!growArray(&tempVelocities, n))return 0;
+	tempCapacity = n;
+	allocations++;
+	return 1;
+}
+
+char OpticalFlowTracker::reserveTrackLists(unsigned int n){
+	if(n <= trackCapacity)return 1;
+	n = growCapacity(trackCapacity, n);
+	if(!growArray(&status, n) || !growArray(&newPositions, n) || !growArray(&fbErrors, n) ||
+		!growArray(&backStatus, n) || !growArray(&backPoints, 2*n))return 0;
+	trackCapacity = n;
+	allocations++;
 	return 1;
 }
 
 /*******************************Public methods*********************************/
 		
+//The current pyramid, which holds a copy of the frame, becomes the previous one
 char OpticalFlowTracker::storePreviousImage(){
-	if(!checkImages())return 0;
-	CvMat* tmp;
-	cvCopy(currentImage, previousImage, 0);
+	ImagePyramid *tmp;
+	if(!currentPyramid->isValid()){strcpy_s(error, 255, "OpticalFlowTracker::storePreviousImage failed");return 0;}
 	CV_SWAP(currentPyramid, previousPyramid, tmp);
 	return 1;
 }
@@ -88,11 +127,13 @@ char OpticalFlowTracker::storePreviousImage(){
 char OpticalFlowTracker::setImage(CvMat *image){
 	if(!image){strcpy_s(error, 255, "OpticalFlowTracker::setImage failed");return 0;}
 	currentImage = image;
-	return checkImages();
+	if(!currentPyramid->build(image, windowSize, pyramidLevels)){strcpy_s(error, 255, currentPyramid->getErrorMess());return 0;}
+	return 1;
 }
 
 char OpticalFlowTracker::trackFeatures(){
-	if((!currentImage)||(!previousImage)||(!currentPyramid)||(!previousPyramid)){
+	CVFLOW_TASK("trackFeatures");
+	if((!currentImage)||(!currentPyramid->isValid())||(!previousPyramid->isValid())){
 		strcpy_s(error, 255, "OpticalFlowTracker::trackFeatures failed");
 		return 0;
 	}
@@ -102,59 +143,229 @@ char OpticalFlowTracker::trackFeatures(){
 		return 0;
 	}
 	
-	cvCalcOpticalFlowPyrLK(previousImage, currentImage, previousPyramid, currentPyramid,
-					 features, newPositions, featureCount, windowSize, pyramidLevels, status,
-					 0 , cvTermCriteria(CV_TERMCRIT_ITER|CV_TERMCRIT_EPS,20,0.03), flags);
-	flags |= CV_LKFLOW_PYR_A_READY;
+	globalMotion.reset();
+	if(useGlobalMotion && !globalMotion.estimate(*previousPyramid, *currentPyramid)){
+		strcpy_s(error, 255, globalMotion.getErrorMess());
+		return 0;
+	}
 	
+	//Start from the predicted positions, kept inside the image. Tracks
+	//that have moved before use their own velocity, others the global shift.
+	int trackFlags = flags;
+	if(predict || useGlobalMotion){
+		float right = (float)(currentImage->cols - 1), bottom = (float)(currentImage->rows - 1);
+		CvPoint2D32f d, g = globalMotion.getShift();
+		for(unsigned int i=0;i<featureCount;i++){
+			d = predict && (ages[i] > 0) ? velocities[i] : g;
+			newPositions[i].x = MIN(MAX(features[i].x + d.x, 0.f), right);
+			newPositions[i].y = MIN(MAX(features[i].y + d.y, 0.f), bottom);
+		}
+		trackFlags |= cv::OPTFLOW_USE_INITIAL_FLOW;
+	}
+	
+	if(!lk.track(previousPyramid, currentPyramid, features, newPositions, status, 0, featureCount, windowSize, pyramidLevels,
+					cvTermCriteria(CV_TERMCRIT_ITER|CV_TERMCRIT_EPS,budget.getIterations(maxIterations),0.03), trackFlags)){
+		strcpy_s(error, 255, lk.getErrorMess());
+		return 0;
+	}
+	
+	return checkFeatures();
+}
+
+/*Tracks the points that were found back into the previous frame, reusing
+  both pyramids, and drops the ones that do not return to where they
+  started. The backward search starts from the original positions.*/
+char OpticalFlowTracker::checkFeatures(){
+	CVFLOW_TASK("checkFeatures");
+	unsigned int i, n;
+	if(!fbCheck){
+		for(i=0;i<featureCount;i++)fbErrors[i] = 0.f;
+		return 1;
+	}
+	
+	CvPoint2D32f *start = backPoints, *end = backPoints + featureCount;
+	for(i=0, n=0;i<featureCount;i++){
+		if(!status[i])continue;
+		start[n] = newPositions[i];
+		end[n] = features[i];
+		n++;
+	}
+	if(!lk.track(currentPyramid, previousPyramid, start, end, backStatus, 0, n, windowSize, pyramidLevels,
+					cvTermCriteria(CV_TERMCRIT_ITER|CV_TERMCRIT_EPS,budget.getIterations(maxIterations),0.03), flags | cv::OPTFLOW_USE_INITIAL_FLOW)){
+		strcpy_s(error, 255, lk.getErrorMess());
+		return 0;
+	}
+	
+	float dx, dy, limit = fbThreshold * fbThreshold;
+	for(i=0, n=0;i<featureCount;i++){
+		fbErrors[i] = 0.f;
+		if(!status[i])continue;
+		dx = end[n].x - features[i].x;
+		dy = end[n].y - features[i].y;
+		fbErrors[i] = sqrtf(dx*dx + dy*dy);
+		if(!backStatus[n] || (dx*dx + dy*dy > limit))status[i] = 0;
+		n++;
+	}
 	return 1;
 }
 
 char OpticalFlowTracker::processFrame(CvMat *image){
+	CVFLOW_FRAME(traceId, frameIndex++);
+	CVFLOW_TASK("processFrame");
+	StageTimer timer, frameTimer;
 	if(!setImage(image))return 0;
-	if(!featureDetector.findFeatures(previousImage)){strcpy_s(error, 255, featureDetector.getErrorMess()); return 0;}
-	if(!updateFeatureList())return 0;
+	stats.record(TRACKER_STAGE_PYRAMID, timer.lap());
+	if(!previousPyramid->sameSize(*currentPyramid) || !previousPyramid->fits(windowSize, pyramidLevels)){
+		//Nothing to track from (first frame, new size or larger window): start over from this frame
+		clearTracks();
+		budget.reset();
+		return storePreviousImage();
+	}
+	
+	//Settings for this frame, scaled down if the last frames were over budget
+	unsigned int limit = budget.getMaxFeatures(maxFeatures);
+	featureDetector.setThreshold(budget.getThreshold(detectorThreshold));
+	featureDetector.setInterval(budget.getInterval(detectionInterval));
+	featureDetector.setMaxCount(featureCount < limit ? limit - featureCount : 1);
+	
+	const CvPoint2D32f *found;
+	unsigned int foundCount;
+	double detectTime, trackTime, t;
+	timer.lap();
+	if(!detectFeatures(&found, &foundCount))return 0;
+	stats.record(TRACKER_STAGE_DETECT, detectTime = timer.lap());
+	if(!updateFeatureList(limit, found, foundCount))return 0;
+	stats.record(TRACKER_STAGE_UPDATE, t = timer.lap());
+	detectTime += t;
 	if(!trackFeatures())return 0;
+	stats.record(TRACKER_STAGE_TRACK, trackTime = timer.lap());
 	if(!calculateVectors())return 0;
+	stats.record(TRACKER_STAGE_VECTORS, t = timer.lap());
+	trackTime += t;
 	if(!findFriends())return 0;
-	return storePreviousImage();
+	stats.record(TRACKER_STAGE_FRIENDS, t = timer.lap());
+	trackTime += t;
+	if(!storePreviousImage())return 0;
+	
+	t = frameTimer.lap();
+	stats.record(TRACKER_STAGE_FRAME, t);
+	stats.latency.add(t);
+	stats.frames++;
+	stats.features = featureCount;
+	stats.vectors = vectorCount;
+	stats.goodVectors = goodVectorCount;
+	budget.update((float)detectTime, (float)trackTime, (float)t);
+	
+	if(publishTelemetry){
+		if(!telemetry.open(traceId)){strcpy_s(error, 255, telemetry.getErrorMess()); return 0;}
+		telemetry.publish(stats);
+	}
+	return 1;
 }
 
-char OpticalFlowTracker::updateFeatureList(){
-	unsigned int totalCount = featureCount+featureDetector.getCount();
-	if(totalCount < 1)return 1;
-	CvPoint2D32f* tempFeatures = (CvPoint2D32f*)malloc(sizeof(CvPoint2D32f)*totalCount);
-	if(!tempFeatures){strcpy_s(error, 255,"OpticalFlowTracker::updateFeatureList failed: tempFeatures"); return 0;}
-	unsigned int* tempIndices = (unsigned int*)malloc(sizeof(unsigned int)*totalCount);
-	if(!tempFeatures){strcpy_s(error, 255,"OpticalFlowTracker::updateFeatureList failed: tempIndices"); return 0;}
-	unsigned int* tempAges = (unsigned int*)malloc(sizeof(unsigned int)*totalCount);
-	if(!tempAges){strcpy_s(error, 255,"OpticalFlowTracker::updateFeatureList failed: tempAges"); return 0;}
+/*New features for the previous frame. Without background detection they
+  are detected right away. Otherwise, the results of the last background
+  detection, if any, are tracked from their snapshot to the previous frame,
+  and the next detection is started on the previous frame.*/
+char OpticalFlowTracker::detectFeatures(const CvPoint2D32f **found, unsigned int *count){
+	CVFLOW_TASK("detectFeatures");
+	//Features close to surviving tracks would be pruned in updateFeatureList
+	float radius = minDistance*(float)currentImage->cols*sqrtf(1.5f);
+	*found = 0;
+	*count = 0;
 	
-	CvPoint2D32f* f = featureDetector.getFeaturePtr();
-	unsigned int c = featureDetector.getCount();
+	if(!asyncDetection){
+		featureDetector.setOccupied(newPositions, status, featureCount, radius);
+		if(!featureDetector.findFeatures(previousPyramid->getImage())){strcpy_s(error, 255, featureDetector.getErrorMess()); return 0;}
+		*found = featureDetector.getFeaturePtr();
+		*count = featureDetector.getCount();
+		return 1;
+	}
+	
+	//Fail this frame only: the next one starts a new detection
+	if(asyncDetector.hasFailed()){
+		strcpy_s(error, 255, asyncDetector.getErrorMess());
+		asyncDetector.discard();
+		return 0;
+	}
+	const CvPoint2D32f *f;
+	const ImagePyramid *snapshot;
+	unsigned int i, n, c;
+	if(asyncDetector.collect(&f, &c, &snapshot)){
+		//Settings may have changed since the snapshot was taken
+		if(c && snapshot->sameSize(*previousPyramid) && snapshot->fits(windowSize, pyramidLevels)){
+			if(c > detectedCapacity){
+				n = growCapacity(detectedCapacity, c);
+				if(!growArray(&detected, n) || !growArray(&detectedStatus, n)){
+					asyncDetector.release();
+					strcpy_s(error, 255, "OpticalFlowTracker::detectFeatures failed");
+					return 0;
+				}
+				detectedCapacity = n;
+				allocations++;
+			}
+			if(!lk.track(snapshot, previousPyramid, f, detected, detectedStatus, 0, c, windowSize, pyramidLevels,
+							cvTermCriteria(CV_TERMCRIT_ITER|CV_TERMCRIT_EPS,budget.getIterations(maxIterations),0.03), flags)){
+				asyncDetector.release();
+				strcpy_s(error, 255, lk.getErrorMess());
+				return 0;
+			}
+			for(i=0, n=0;i<c;i++)if(detectedStatus[i])detected[n++] = detected[i];
+			*found = detected;
+			*count = n;
+		}
+		asyncDetector.release();
+	}
+	
+	if((++framesSinceDetection >= featureDetector.getInterval()) && asyncDetector.isIdle()){
+		if(!asyncDetector.submit(previousPyramid->getImage(), featureDetector, newPositions, status, featureCount, radius,
+								windowSize, pyramidLevels)){
+			strcpy_s(error, 255, asyncDetector.getErrorMess());
+			return 0;
+		}
+		framesSinceDetection = 0;
+	}
+	return 1;
+}
+
+//At most limit tracks are kept, surviving ones first
+char OpticalFlowTracker::updateFeatureList(unsigned int limit, const CvPoint2D32f *f, unsigned int c){
+	CVFLOW_TASK("updateFeatureList");
+	unsigned int totalCount = featureCount+c;
+	if(totalCount < 1)return 1;
+	if(!reserveTempLists(totalCount)){strcpy_s(error, 255,"OpticalFlowTracker::updateFeatureList failed: temp lists"); return 0;}
 	
 	//Merge into new list features that were tracked successfully
-	unsigned int i,j, index=0;
-	float dx, dy;
+	unsigned int i, index=0;
 	float d_thresh = minDistance*(float)currentImage->cols; d_thresh*=(d_thresh*1.5f);
+	float width = (float)currentImage->cols;
+	float height = (float)currentImage->rows;
+	float dx, dy;
 	bool isolated;
+	
+	//Minimal distance is enforced through a grid with cells as wide as that
+	//distance, so that each feature is only compared with its neighbours.
+	bool prune = d_thresh > 0.f;
+	if(prune){
+		grid.setup(0.f, 0.f, width, height, sqrtf(d_thresh), featureCount);
+		for(i=0;i<featureCount;i++)grid.insert(newPositions[i].x, newPositions[i].y);
+	}
 	for(i=0;i<featureCount;i++){
 		if(status[i]){
 			//check against other features, implement minimal distance
-			isolated = true;
-			for(j=0;j<featureCount;j++){
-				if(i==j)continue;
-				dx=newPositions[j].x - newPositions[i].x; dx*=dx;
-				dy=newPositions[j].y - newPositions[i].y; dy*=dy;
-				if((dx+dy)<d_thresh){
-					isolated = false;
-					break;
-				}
-			}
-			if(isolated){
+			isolated = !prune || !grid.hasNeighbour(newPositions[i].x, newPositions[i].y, d_thresh, (int)i);
+			if(isolated && (index < limit)){
 				tempFeatures[index] = newPositions[i];
 				tempIndices[index] = indices[i];
-				tempAges[index] = tempAges[index] < maxAge ? ages[i]+1 : maxAge;
+				tempAges[index] = ages[i] < maxAge ? ages[i]+1 : maxAge;
+				//Constant velocity, smoothed over the last few frames
+				dx = newPositions[i].x - features[i].x;
+				dy = newPositions[i].y - features[i].y;
+				if(ages[i] > 0){
+					dx = 0.5f * (dx + velocities[i].x);
+					dy = 0.5f * (dy + velocities[i].y);
+				}
+				tempVelocities[index] = cvPoint2D32f(dx, dy);
 				index++;
 			}
 			else{
@@ -167,74 +378,63 @@ char OpticalFlowTracker::updateFeatureList(){
 	}
 		
 	unsigned int newcount = index;
-	for(i=0;i<c;i++){
-		isolated = true;
-		for(j=0;j<newcount;j++){
-			dx=tempFeatures[j].x - f[i].x; dx*=dx;
-			dy=tempFeatures[j].y - f[i].y; dy*=dy;
-			if((dx+dy)<d_thresh){
-				isolated = false;
-				break;
-			}
-		}
+	if(prune){
+		grid.setup(0.f, 0.f, width, height, sqrtf(d_thresh), newcount);
+		for(i=0;i<newcount;i++)grid.insert(tempFeatures[i].x, tempFeatures[i].y);
+	}
+	for(i=0;(i<c)&&(index<limit);i++){
+		isolated = !prune || !grid.hasNeighbour(f[i].x, f[i].y, d_thresh, -1);
 		if(isolated){
 			tempFeatures[index] = f[i];
 			tempIndices[index] = indexManager.getIndex();
 			tempAges[index] = 0;
+			tempVelocities[index] = cvPoint2D32f(0.f, 0.f);
 			index++;
 		}
 	}
 	
-	free(features);
-	free(indices);
-	free(ages);
-	
-	features = tempFeatures;
-	indices = tempIndices;
-	ages = tempAges;
+	CvPoint2D32f* tmpf;
+	unsigned int* tmpu;
+	unsigned int tmpc;
+	CV_SWAP(features, tempFeatures, tmpf);
+	CV_SWAP(indices, tempIndices, tmpu);
+	CV_SWAP(ages, tempAges, tmpu);
+	CV_SWAP(velocities, tempVelocities, tmpf);
+	CV_SWAP(featureCapacity, tempCapacity, tmpc);
 	
 	featureCount = index;
 	
-	status = (char*)realloc(status, sizeof(char)*featureCount);
-	if(!status){strcpy_s(error, 255,"OpticalFlowTracker::updateFeatureList failed: status"); return 0;};
-	
-	newPositions = (CvPoint2D32f*)realloc(newPositions, sizeof(CvPoint2D32f)*featureCount);
-	if(!newPositions){strcpy_s(error, 255,"OpticalFlowTracker::updateFeatureList failed: newPositions"); return 0;}
+	if(!reserveTrackLists(featureCount)){strcpy_s(error, 255,"OpticalFlowTracker::updateFeatureList failed: status/newPositions"); return 0;}
 	
 	return 1;
 }
 
 char OpticalFlowTracker::calculateVectors(){
+	CVFLOW_TASK("calculateVectors");
 	vectorCount = 0;
 	if(featureCount < 1)return 1;
 	if((!features)||(!newPositions)||(!status)||(!ages)||(!indices))
 		{strcpy_s(error, 255,"OpticalFlowTracker::calculateVectors failed"); return 0;}
 	if(!currentImage){strcpy_s(error, 255,"OpticalFlowTracker::calculateVectors failed: currentImage"); return 0;}
-	if(featureCount < 1)return 1;
-	vectors = (Vector*)realloc(vectors,featureCount*sizeof(Vector));
-	if(!vectors){strcpy_s(error, 255,"OpticalFlowTracker::calculateVectors failed: vectors"); return 0;}
+	if(!vectors.reserve(featureCount)){strcpy_s(error, 255,"OpticalFlowTracker::calculateVectors failed: vectors"); return 0;}
 	
+	//Gather successfully tracked features, then normalize and compute
+	//magnitude and angle on the whole arrays at once.
 	unsigned int i,j;
-	float dx, dy;
-	float scale_x = 1.f / currentImage->cols;
-	float scale_y = 1.f / currentImage->rows;
-	
 	for(i=0, j=0;i<featureCount;i++){
 		if(!status[i])continue;
-		vectors[j].x = features[i].x * scale_x;
-		vectors[j].y = features[i].y * scale_y;
-		vectors[j].x2 = newPositions[i].x * scale_x;
-		vectors[j].y2 = newPositions[i].y * scale_y;
-		dx = vectors[j].x - vectors[j].x2;
-		dy = vectors[j].y - vectors[j].y2;
-		vectors[j].alpha = cvSqrt(dx*dx+dy*dy);
-		vectors[j].theta = cvFastArctan(dy,dx);
-		vectors[j].friends = 0;
-		vectors[j].age = ages[i];
-		vectors[j].index = indices[i];
+		vectors.x[j] = features[i].x;
+		vectors.y[j] = features[i].y;
+		vectors.x2[j] = newPositions[i].x;
+		vectors.y2[j] = newPositions[i].y;
+		vectors.fbError[j] = fbErrors[i];
+		vectors.age[j] = ages[i];
+		vectors.index[j] = indices[i];
 		j++;
 	}
 	
+	vectors.count = j;
+	vectors.computePolar(1.f / currentImage->cols, 1.f / currentImage->rows);
 	vectorCount = j;
 	
 	return 1;
@@ -242,8 +442,9 @@ char OpticalFlowTracker::calculateVectors(){
 
 
 char OpticalFlowTracker::findFriends(){
+	CVFLOW_TASK("findFriends");
 	if(featureCount<1)return 1;
-	if(!vectors){strcpy_s(error, 255,"OpticalFlowTracker::findFriends failed: vectors"); return 0;}
+	if(vectorCount && !vectors.x){strcpy_s(error, 255,"OpticalFlowTracker::findFriends failed: vectors"); return 0;}
 	if(!currentImage){strcpy_s(error, 255,"OpticalFlowTracker::findFriends failed: currentImage"); return 0;}
 	
 	const float d_thresh = 0.03f; //Arbitrary distance threshold. = (1/8)^2 + (1/8)^2
@@ -253,41 +454,53 @@ char OpticalFlowTracker::findFriends(){
 	
 	goodVectorCount = 0;
 	
-	unsigned int i,j;
+	//Only vectors in neighbouring cells can be within d_thresh of each other.
+	//They come in index order, so results and early breaks match a full scan.
+	unsigned int i,j,k,n;
 	float dx,dy;
+	const int *neighbours;
+	const float *vx = vectors.x, *vy = vectors.y, *alpha = vectors.alpha, *theta = vectors.theta;
+	unsigned int *friends = vectors.friends;
+	grid.setup(0.f, 0.f, 1.f, 1.f, sqrtf(d_thresh), vectorCount);
+	for(i=0;i<vectorCount;i++)grid.insert(vx[i], vy[i]);
+	grid.sortCells();
+	
 	for(i=0;i<vectorCount;i++){
-		if(vectors[i].friends > maxFriends) continue;
+		if(friends[i] > maxFriends) continue;
 		
-		if(vectors[i].alpha < small_movement){
-			for(j=0;j<vectorCount;j++){
+		neighbours = grid.getNeighbours(vx[i], vy[i], &n);
+		if(alpha[i] < small_movement){
+			for(k=0;k<n;k++){
+				j = (unsigned int)neighbours[k];
 				if(i==j)continue;
-				dx = vectors[i].x - vectors[j].x; dx*=dx;
-				dy = vectors[i].y - vectors[j].y; dy*=dy;
+				dx = vx[i] - vx[j]; dx*=dx;
+				dy = vy[i] - vy[j]; dy*=dy;
 				if((dx+dy)>d_thresh)continue;
-				if(vectors[j].alpha < small_movement){
-					vectors[i].friends++;
-					vectors[j].friends++;
-					if(vectors[i].friends > maxFriends){
-						//if(vectors[i].age == maxAge)goodVectorCount++;
+				if(alpha[j] < small_movement){
+					friends[i]++;
+					friends[j]++;
+					if(friends[i] > maxFriends){
+						//if(age[i] == maxAge)goodVectorCount++;
 						break;
 					}
 				}
 			}
 		}
 		else{
-			for(j=0;j<vectorCount;j++){
+			for(k=0;k<n;k++){
+				j = (unsigned int)neighbours[k];
 				if(i==j)continue;
-				dx = vectors[i].x - vectors[j].x; dx*=dx;
-				dy = vectors[i].y - vectors[j].y; dy*=dy;
+				dx = vx[i] - vx[j]; dx*=dx;
+				dy = vy[i] - vy[j]; dy*=dy;
 				if((dx+dy)>d_thresh)continue;
-				dx = vectors[i].theta - vectors[j].theta; 
+				dx = theta[i] - theta[j]; 
 				if((dx < -337.5f)||((dx < 22.5f)&&(dx > -22.5f))||(dx > 337.5f)){
-					dy = vectors[i].alpha / vectors[j].alpha;
+					dy = alpha[i] / alpha[j];
 					if((dy>0.75)&&(dy<1.25)){
-						vectors[i].friends++;
-						vectors[j].friends++;
-						if(vectors[i].friends > maxFriends){
-							//if(vectors[i].age == maxAge)goodVectorCount++;
+						friends[i]++;
+						friends[j]++;
+						if(friends[i] > maxFriends){
+							//if(age[i] == maxAge)goodVectorCount++;
 							break;
 						}
 					}
@@ -296,30 +509,28 @@ char OpticalFlowTracker::findFriends(){
 		}
 	}
 	
-	for(i=0;i<vectorCount;i++)if((vectors[i].age == maxAge)&&(vectors[i].friends > maxFriends))goodVectorCount++;
+	const unsigned int *age = vectors.age;
+	for(i=0;i<vectorCount;i++)if((age[i] == maxAge)&&(friends[i] > maxFriends))goodVectorCount++;
 	
 	return 1;
 }
 
 
 void OpticalFlowTracker::reset(){
-	cvReleaseMat(&previousImage);
-	cvReleaseMat(&currentPyramid);
-	cvReleaseMat(&previousPyramid);
-	free(newPositions); newPositions = 0;
-	free(vectors); vectors = 0;
-	free(status); status = 0;
-	free(indices); indices = 0;
-	free(ages); ages = 0;
-	indexManager.reset();
-	featureCount = 0;
-	vectorCount = 0;
-	goodVectorCount = 0;
+	pyramids[0].invalidate();
+	pyramids[1].invalidate();
+	clearTracks();
+	featureDetector.restart();
+	globalMotion.reset();
+	budget.reset();
+	asyncDetector.discard();
+	framesSinceDetection = 0;
 	flags = 0;
 }
 
 
 IndexManager::IndexManager(){
+	allocations = 1;
 	indexStack.reserve(1024);
 	indexStack.push_back(1);
 	
@@ -328,6 +539,7 @@ IndexManager::IndexManager(){
 unsigned int IndexManager::getIndex()
 {
 	if(indexStack.capacity()<1024){
+		allocations++;
 		indexStack.reserve(1024);
 		indexStack.push_back(1);
 	}
@@ -338,6 +550,7 @@ unsigned int IndexManager::getIndex()
 }
 
 void IndexManager::removeIndex(unsigned int ndx){
+	if(indexStack.size() == indexStack.capacity())allocations++;
 	indexStack.push_back(ndx);
 }
 
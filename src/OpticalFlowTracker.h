@@ -2,6 +2,14 @@
 #define _OPTICALFLOWTRACKER_H_
 
 #include "FeatureDetector.h"
+#include "SpatialGrid.h"
+#include "FlowVectors.h"
+#include "ParallelLK.h"
+#include "GlobalMotion.h"
+#include "BudgetController.h"
+#include "AsyncDetector.h"
+#include "FlowStats.h"
+#include "Telemetry.h"
 
 #include "opencv.hpp"
 #include <vector>
@@ -11,22 +19,22 @@ using namespace std;
 
 /*Errors*/
 
-typedef struct _vector
-{
-	float x;
-	float y;
-	float x2;
-	float y2;
-	float alpha;
-	float theta;
-	unsigned int friends;
-	unsigned int age;
-	unsigned int index;
-}Vector;
+//Stages timed in FlowStats
+enum{
+	TRACKER_STAGE_PYRAMID,
+	TRACKER_STAGE_DETECT,
+	TRACKER_STAGE_UPDATE,
+	TRACKER_STAGE_TRACK,
+	TRACKER_STAGE_VECTORS,
+	TRACKER_STAGE_FRIENDS,
+	TRACKER_STAGE_FRAME,
+	TRACKER_STAGE_COUNT
+};
 
 class IndexManager{
 	private:
 		vector<unsigned int> indexStack;
+		unsigned int allocations;
 	public:
 		IndexManager();		
 		~IndexManager(){;}
@@ -34,26 +42,49 @@ class IndexManager{
 		unsigned int getIndex();		
 		void removeIndex(unsigned int ndx);		
 		void reset();
+		unsigned int getAllocationCount(){return allocations;}
 };
 
 class OpticalFlowTracker{
 	private:
 		CvMat *currentImage;
-		CvMat *previousImage;
-		CvMat *currentPyramid;
-		CvMat *previousPyramid;
+		ImagePyramid pyramids[2];
+		ImagePyramid *currentPyramid;
+		ImagePyramid *previousPyramid;
 		CvPoint2D32f *features;
 		CvPoint2D32f *newPositions;
 		CvPoint2D32f dummyPoint;
-		Vector *vectors;
-		Vector dummyVector;
+		FlowVectors vectors;
 		char *status;
+		float *fbErrors;
+		CvPoint2D32f *backPoints;
+		char *backStatus;
 		unsigned int *indices;
 		unsigned int *ages;
+		CvPoint2D32f *velocities;
+		CvPoint2D32f *tempFeatures;
+		unsigned int *tempIndices;
+		unsigned int *tempAges;
+		CvPoint2D32f *tempVelocities;
+		unsigned int featureCapacity;
+		unsigned int tempCapacity;
+		unsigned int trackCapacity;
+		unsigned int allocations;
 		unsigned int maxAge;
 		unsigned int maxFriends;
 		IndexManager indexManager;
 		FeatureDetector featureDetector;
+		SpatialGrid grid;
+		ParallelLK lk;
+		GlobalMotion globalMotion;
+		BudgetController budget;
+		FlowStats stats;
+		TelemetryPublisher telemetry;
+		AsyncDetector asyncDetector;
+		CvPoint2D32f *detected;		//Background detections, tracked forward
+		char *detectedStatus;
+		unsigned int detectedCapacity;
+		unsigned int framesSinceDetection;
 		char dummyChar;
 		unsigned int featureCount;
 		unsigned int vectorCount;
@@ -61,12 +92,27 @@ class OpticalFlowTracker{
 		CvSize windowSize;
 		unsigned int pyramidLevels;
 		int flags;
+		int traceId;
+		unsigned int frameIndex;
+		bool predict;
+		bool useGlobalMotion;
+		bool fbCheck;
+		bool asyncDetection;
+		bool publishTelemetry;
+		float fbThreshold;
 		float minDistance;
+		float detectorThreshold;	//User settings, scaled down by budget
+		unsigned int detectionInterval;
+		unsigned int maxFeatures;
+		int maxIterations;
 		char error[256];
 		
-		char rebuildImages();
-		char checkImages();
-		char updateFeatureList();
+		void clearTracks();
+		char reserveTempLists(unsigned int n);
+		char reserveTrackLists(unsigned int n);
+		char detectFeatures(const CvPoint2D32f **found, unsigned int *count);
+		char updateFeatureList(unsigned int limit, const CvPoint2D32f *f, unsigned int c);
+		char checkFeatures();
 		char calculateVectors();
 		char findFriends();
 		
@@ -80,6 +126,10 @@ class OpticalFlowTracker{
 		void setPyramidLevels(unsigned int l){pyramidLevels = l;}
 		unsigned int getPyramidLevels(){return pyramidLevels;}
 		
+		//Number of feature batches tracked concurrently, 0 for automatic
+		void setThreads(int t){lk.setThreads(t);}
+		int getThreads(){return lk.getThreads();}
+		
 		void setWindowSize(unsigned int s){
 			windowSize = s > 0 ? cvSize(s,s) : cvSize(1,1);
 		}
@@ -94,8 +144,74 @@ class OpticalFlowTracker{
 		}
 		float getMinDistance(){return minDistance;}
 		
-		void setDetectorThreshold(float t){featureDetector.setThreshold(t);}
-		float getDetectorThreshold(){return featureDetector.getThreshold();}
+		void setDetectorThreshold(float t){detectorThreshold = t < 0.001f ? 0.001f : (t > 1.f ? 1.f : t);}
+		float getDetectorThreshold(){return detectorThreshold;}
+		
+		void setTiles(int cols, int rows){featureDetector.setTiles(cols, rows);}
+		int getTileCols(){return featureDetector.getTileCols();}
+		int getTileRows(){return featureDetector.getTileRows();}
+		
+		void setUseOccupancy(bool o){featureDetector.setUseOccupancy(o);}
+		bool getUseOccupancy(){return featureDetector.getUseOccupancy();}
+		
+		void setDetectionInterval(unsigned int n){detectionInterval = n < 1 ? 1 : n;}
+		unsigned int getDetectionInterval(){return detectionInterval;}
+		
+		//Largest number of tracks, old and new
+		void setMaxFeatures(unsigned int n){maxFeatures = n < 1 ? 1 : (n > MAX_EIG_FEATURE_COUNT ? MAX_EIG_FEATURE_COUNT : n);}
+		unsigned int getMaxFeatures(){return maxFeatures;}
+		
+		//Largest number of LK iterations per level
+		void setMaxIterations(int n){maxIterations = n < 1 ? 1 : n;}
+		int getMaxIterations(){return maxIterations;}
+		
+		/*Time budget in milliseconds for processFrame, 0 for none. Detection
+		  threshold and interval, feature count and LK iterations are then
+		  scaled down from the settings above as needed to stay within it.*/
+		void setBudget(float ms){budget.setBudget(ms);}
+		float getBudget(){return budget.getBudget();}
+		float getFrameTime(){return budget.getFrameTime();}
+		
+		void setFastThreshold(int t){featureDetector.setFastThreshold(t);}
+		int getFastThreshold(){return featureDetector.getFastThreshold();}
+		
+		/*Prediction: each track keeps a smoothed velocity, and LK starts
+		  from the position it predicts instead of the previous one.*/
+		void setPrediction(bool p){predict = p;}
+		bool getPrediction(){return predict;}
+		
+		/*Global motion: the translation of the whole frame, estimated on a
+		  coarse level, seeds LK for tracks without a velocity of their own
+		  (all of them when prediction is off).*/
+		void setGlobalMotion(bool g){useGlobalMotion = g;}
+		bool getGlobalMotion(){return useGlobalMotion;}
+		CvPoint2D32f getGlobalShift(){return globalMotion.getShift();}
+		
+		/*Background detection: features are detected on a worker thread
+		  against a snapshot of the frame, then tracked forward to the
+		  current frame once they are ready, so that frames only wait for
+		  tracking. New features arrive a few frames later.*/
+		void setAsyncDetection(bool a){
+			asyncDetection = a;
+			if(!a)asyncDetector.stop();
+		}
+		bool getAsyncDetection(){return asyncDetection;}
+		
+		/*Publishes stats after every frame to a shared memory segment named
+		  /cvflow.<pid>.<trace id>, for cvflow_stat and other monitors. The
+		  segment is created on the next frame and removed as soon as it is
+		  turned off.*/
+		void setTelemetry(bool t){publishTelemetry = t; if(!t)telemetry.close();}
+		bool getTelemetry(){return publishTelemetry;}
+		const char* getTelemetryName(){return telemetry.getName();}
+		
+		/*Forward-backward check: tracked points are tracked back into the
+		  previous frame, and dropped if they land more than fbThreshold
+		  pixels away from where they started.*/
+		void setForwardBackward(bool c){fbCheck = c;}
+		bool getForwardBackward(){return fbCheck;}
+		void setForwardBackwardThreshold(float t){fbThreshold = t < 0.f ? 0.f : t;}
+		float getForwardBackwardThreshold(){return fbThreshold;}
 		
 		void setMaxAge(unsigned int a){maxAge = a;}
 		unsigned int getMaxAge(){return maxAge;}
@@ -104,9 +220,8 @@ class OpticalFlowTracker{
 		
 		unsigned int getVectorCount(){return vectorCount;}
 		unsigned int getGoodVectorCount(){return goodVectorCount;}
-		Vector* getVectorPtr(){return vectors;}
-		Vector* vectorAt(unsigned int ndx){if(ndx<vectorCount)return vectors+ndx; else return &dummyVector;}
-		bool isGoodVector(unsigned int ndx){return (ndx < vectorCount)&&(vectors[ndx].age == maxAge)&&(vectors[ndx].friends > maxFriends);}
+		const FlowVectors& getVectors(){return vectors;}
+		bool isGoodVector(unsigned int ndx){return (ndx < vectorCount)&&(vectors.age[ndx] == maxAge)&&(vectors.friends[ndx] > maxFriends);}
 		
 		unsigned int getMaxFriends(){return maxFriends;}
 		
@@ -118,10 +233,27 @@ class OpticalFlowTracker{
 		CvPoint2D32f* getNewPositionPtr(){return newPositions;}
 		
 		CvMat* getCurrentImage(){return currentImage;}
-		CvMat* getPreviousImage(){return previousImage;}
+		CvMat* getPreviousImage(){return previousPyramid->getImage();}
 		
 		const char* getErrorMess(){return error;}
 		
+		//Stage timings and counts of the frames processed so far
+		const FlowStats& getStats(){return stats;}
+		void resetStats(){stats.reset();}
+		//Instance id and frame number in TraceRecorder timelines
+		int getTraceId(){return traceId;}
+		unsigned int getFrameIndex(){return frameIndex;}
+		
+		/*Number of times any of the buffers used by the per-frame loop had to
+		  grow or be recreated. Constant once the tracker has warmed up at a
+		  given resolution; allocations made inside OpenCV are not counted.*/
+		unsigned int getAllocationCount(){
+			return allocations + vectors.allocations + grid.getAllocationCount() +
+				featureDetector.getAllocationCount() + indexManager.getAllocationCount() +
+				pyramids[0].getAllocationCount() + pyramids[1].getAllocationCount() +
+				globalMotion.getAllocationCount() + asyncDetector.getAllocationCount();
+		}
+		
 		char storePreviousImage();
 		char setImage(CvMat *image);
 		char trackFeatures();
@@ -0,0 +1,77 @@
+#include "ParallelLK.h"
+#include "Profiling.h"
+
+class LKBatchBody : public cv::ParallelLoopBody{
+	private:
+		const vector<cv::Mat> *previous;
+		const vector<cv::Mat> *current;
+		const CvPoint2D32f *points;
+		CvPoint2D32f *newPoints;
+		char *status;
+		float *err;
+		int count;
+		int batches;
+		cv::Size window;
+		int levels;
+		cv::TermCriteria criteria;
+		int flags;
+		TraceContext context;	//Of the calling thread
+
+	public:
+		LKBatchBody(const vector<cv::Mat> *p, const vector<cv::Mat> *c, const CvPoint2D32f *pts, CvPoint2D32f *newPts,
+			char *s, float *e, int n, int b, cv::Size w, int l, cv::TermCriteria t, int f){
+			previous = p; current = c; points = pts; newPoints = newPts; status = s; err = e;
+			count = n; batches = b; window = w; levels = l; criteria = t; flags = f;
+			context = TraceRecorder::getContext();
+		}
+
+		void operator()(const cv::Range &range) const{
+			CVFLOW_FRAME_CONTEXT(context);
+			CVFLOW_TASK("lkBatch");
+			int start = (int)((int64)count * range.start / batches);
+			int end = (int)((int64)count * range.end / batches);
+			int n = end - start;
+			if(n < 1)return;
+			cv::Mat p(n, 1, CV_32FC2, (void*)(points + start));
+			cv::Mat np(n, 1, CV_32FC2, (void*)(newPoints + start));
+			cv::Mat s(n, 1, CV_8UC1, (void*)(status + start));
+			if(err){
+				cv::Mat e(n, 1, CV_32FC1, (void*)(err + start));
+				cv::calcOpticalFlowPyrLK(*previous, *current, p, np, s, e, window, levels, criteria, flags);
+			}
+			else cv::calcOpticalFlowPyrLK(*previous, *current, p, np, s, cv::noArray(), window, levels, criteria, flags);
+		}
+};
+
+ParallelLK::ParallelLK(){
+	threads = 0;
+	error[0] = 0;
+}
+
+char ParallelLK::track(const ImagePyramid *previous, const ImagePyramid *current, const CvPoint2D32f *points, CvPoint2D32f *newPoints,
+	char *status, float *err, unsigned int count, CvSize window, int levels, CvTermCriteria criteria, int flags){
+	if((!previous)||(!current)||(!points)||(!newPoints)||(!status)){
+		strcpy_s(error, 255, "ParallelLK::track failed");
+		return 0;
+	}
+	if(!previous->fits(window, levels) || !current->fits(window, levels) || !previous->sameSize(*current)){
+		strcpy_s(error, 255, "ParallelLK::track failed: pyramids do not match");
+		return 0;
+	}
+	if(count < 1)return 1;
+
+	int batches = threads > 0 ? threads : cv::getNumThreads();
+	if(batches < 1)batches = 1;
+	if(batches > (int)count)batches = (int)count;
+	LKBatchBody body(&previous->getLevels(), &current->getLevels(), points, newPoints, status, err, (int)count, batches,
+		cv::Size(window.width, window.height), levels, cv::TermCriteria(criteria), flags);
+	try{
+		if(batches == 1)body(cv::Range(0, 1));
+		else cv::parallel_for_(cv::Range(0, batches), body, batches);
+	}
+	catch(cv::Exception &e){
+		strcpy_s(error, 255, e.what());
+		return 0;
+	}
+	return 1;
+}
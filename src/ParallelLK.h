@@ -0,0 +1,33 @@
+#ifndef _PARALLELLK_H_
+#define _PARALLELLK_H_
+
+#include "opencv.hpp"
+#include "Portability.h"
+#include "ImagePyramid.h"
+
+/*Pyramidal Lucas-Kanade over batches of features. Every batch is tracked
+  against the same pair of pre-built pyramids, and batches run concurrently
+  on OpenCV's thread pool.*/
+class ParallelLK{
+	private:
+		int threads;
+		char error[256];
+
+	public:
+		ParallelLK();
+		~ParallelLK(){;}
+
+		//Number of concurrent batches. 0 uses OpenCV's thread count.
+		void setThreads(int t){threads = t < 0 ? 0 : t;}
+		int getThreads(){return threads;}
+
+		/*Tracks count points from previous into current. Both pyramids must
+		  fit window and levels. status is set to 1 for points that were found,
+		  err (may be NULL) receives the tracking error.*/
+		char track(const ImagePyramid *previous, const ImagePyramid *current, const CvPoint2D32f *points, CvPoint2D32f *newPoints,
+			char *status, float *err, unsigned int count, CvSize window, int levels, CvTermCriteria criteria, int flags);
+
+		const char* getErrorMess(){return error;}
+};
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef _PORTABILITY_H_
+#define _PORTABILITY_H_
+
+#include <stdio.h>
+#include <string.h>
+
+/*strcpy_s is only provided by the Microsoft CRT. Elsewhere, fall back on a
+  truncating copy so that error messages can be set the same way everywhere.*/
+#ifndef _MSC_VER
+inline int strcpy_s(char *dest, size_t size, const char *src){
+	if((!dest)||(size < 1))return 1;
+	if(!src){dest[0] = 0; return 1;}
+	snprintf(dest, size, "%s", src);
+	return 0;
+}
+#endif
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef _PROFILING_H_
+#define _PROFILING_H_
+
+#include "TraceRecorder.h"
+
+/*Stage annotations. CVFLOW_TASK("name") covers the rest of the enclosing
+  scope: it is recorded by TraceRecorder while a trace is running and, when
+  built with CVFLOW_ITT defined and ittnotify linked, shows as a task of the
+  "cv.jit.flow" ITT domain in VTune and other ITT-aware profilers.
+
+  CVFLOW_FRAME(instance, frame) tags the tasks of the enclosing scope with
+  a tracker instance and frame number, unless an outer scope already set
+  that instance, whose frame number is then kept. CVFLOW_FRAME_CONTEXT(context)
+  does the same on another thread with a context captured by the caller.
+  CVFLOW_THREAD_NAME("name") names the calling thread.*/
+
+#define CVFLOW_CONCAT_(a, b) a##b
+#define CVFLOW_CONCAT(a, b) CVFLOW_CONCAT_(a, b)
+
+#define CVFLOW_FRAME(instance, frame) TraceFrame CVFLOW_CONCAT(traceFrame, __LINE__)(instance, frame)
+#define CVFLOW_FRAME_CONTEXT(context) TraceFrame CVFLOW_CONCAT(traceFrame, __LINE__)(context)
+
+#ifdef CVFLOW_ITT
+
+#include <ittnotify.h>
+
+inline __itt_domain* cvflowIttDomain(){
+	static __itt_domain *domain = __itt_domain_create("cv.jit.flow");
+	return domain;
+}
+
+class IttTask{
+	private:
+		__itt_domain *domain;
+	public:
+		IttTask(__itt_string_handle *name){
+			domain = cvflowIttDomain();
+			__itt_task_begin(domain, __itt_null, __itt_null, name);
+		}
+		~IttTask(){__itt_task_end(domain);}
+};
+
+//String handles are created once per call site
+#define CVFLOW_TASK(name) \
+	TraceScope CVFLOW_CONCAT(traceTask, __LINE__)(name); \
+	static __itt_string_handle *CVFLOW_CONCAT(ittName, __LINE__) = __itt_string_handle_create(name); \
+	IttTask CVFLOW_CONCAT(ittTask, __LINE__)(CVFLOW_CONCAT(ittName, __LINE__))
+#define CVFLOW_THREAD_NAME(name) TraceRecorder::get().setThreadName(name); __itt_thread_set_name(name)
+
+#else
+
+#define CVFLOW_TASK(name) TraceScope CVFLOW_CONCAT(traceTask, __LINE__)(name)
+#define CVFLOW_THREAD_NAME(name) TraceRecorder::get().setThreadName(name)
+
+#endif
+
+#endif
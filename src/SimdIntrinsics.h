@@ -0,0 +1,14 @@
+#ifndef _SIMDINTRINSICS_H_
+#define _SIMDINTRINSICS_H_
+
+#include "opencv.hpp"
+
+/*OpenCV 3.3's intrin_sse.hpp refers to CV_CPU_HAS_SUPPORT_SSE2, which is
+  only defined when building OpenCV itself.*/
+#ifndef CV_CPU_HAS_SUPPORT_SSE2
+#define CV_CPU_HAS_SUPPORT_SSE2 CV_SSE2
+#endif
+
+#include "opencv2/core/hal/intrin.hpp"
+
+#endif
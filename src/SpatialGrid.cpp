@@ -0,0 +1,135 @@
+#include "SpatialGrid.h"
+
+#include <math.h>
+
+#define SPATIALGRID_MIN_CELLS 16
+
+SpatialGrid::SpatialGrid(){
+	cols = 1;
+	rows = 1;
+	originX = 0.f;
+	originY = 0.f;
+	invCellSize = 0.f;
+	allocations = 0;
+}
+
+void SpatialGrid::setup(float x, float y, float width, float height, float cellSize, unsigned int capacity){
+	float maxCells = (float)(capacity * 2 > SPATIALGRID_MIN_CELLS ? capacity * 2 : SPATIALGRID_MIN_CELLS);
+	float c, r;
+
+	originX = x;
+	originY = y;
+	if(!(width > 0.f))width = 1.f;
+	if(!(height > 0.f))height = 1.f;
+
+	if(cellSize > 0.f){
+		//Pad the cells a little so that rounding in cellOf() can never put
+		//two points within cellSize of each other two cells apart.
+		cellSize *= 1.001f;
+		//Limit the number of cells: growing the cells keeps queries exact.
+		c = ceilf(width / cellSize);
+		r = ceilf(height / cellSize);
+		if(c * r > maxCells){
+			cellSize *= sqrtf((c * r) / maxCells);
+			c = ceilf(width / cellSize);
+			r = ceilf(height / cellSize);
+		}
+		cols = c < 1.f ? 1 : (int)c;
+		rows = r < 1.f ? 1 : (int)r;
+		invCellSize = 1.f / cellSize;
+	}
+	else{
+		cols = rows = 1;
+		invCellSize = 0.f;
+	}
+
+	if(head.capacity() < (size_t)(cols * rows))allocations++;
+	head.assign(cols * rows, -1);
+	next.clear();
+	px.clear();
+	py.clear();
+	blockPoints.clear();
+	if(next.capacity() < capacity){
+		next.reserve(capacity);
+		px.reserve(capacity);
+		py.reserve(capacity);
+		allocations++;
+	}
+}
+
+void SpatialGrid::cellOf(float x, float y, int *cx, int *cy) const{
+	float fx = (x - originX) * invCellSize;
+	float fy = (y - originY) * invCellSize;
+	//Written so that NaN ends up in cell 0
+	*cx = fx >= 0.f ? (fx < (float)cols ? (int)fx : cols - 1) : 0;
+	*cy = fy >= 0.f ? (fy < (float)rows ? (int)fy : rows - 1) : 0;
+}
+
+int SpatialGrid::insert(float x, float y){
+	int cx, cy, cell;
+	int ndx = (int)px.size();
+	cellOf(x, y, &cx, &cy);
+	cell = cy * cols + cx;
+	if(px.size() == px.capacity())allocations++;
+	px.push_back(x);
+	py.push_back(y);
+	next.push_back(head[cell]);
+	head[cell] = ndx;
+	return ndx;
+}
+
+bool SpatialGrid::hasNeighbour(float x, float y, float sqRadius, int exclude) const{
+	int cx, cy, i, j, k;
+	float dx, dy;
+	cellOf(x, y, &cx, &cy);
+	for(j = cy > 0 ? cy - 1 : 0; (j <= cy + 1)&&(j < rows); j++){
+		for(i = cx > 0 ? cx - 1 : 0; (i <= cx + 1)&&(i < cols); i++){
+			for(k = head[j * cols + i]; k >= 0; k = next[k]){
+				if(k == exclude)continue;
+				dx = px[k] - x; dx*=dx;
+				dy = py[k] - y; dy*=dy;
+				if((dx+dy) < sqRadius)return true;
+			}
+		}
+	}
+	return false;
+}
+
+void SpatialGrid::sortCells(){
+	int i, j, k, cell, cx, cy, cells = cols * rows, n = (int)px.size(), total = 0;
+	if(blockStart.capacity() < (size_t)(cells + 1))allocations++;
+	blockStart.assign(cells + 1, 0);
+	//A point goes in the block of every cell next to its own
+	for(k=0;k<n;k++){
+		cellOf(px[k], py[k], &cx, &cy);
+		for(j = cy > 0 ? cy - 1 : 0; (j <= cy + 1)&&(j < rows); j++){
+			for(i = cx > 0 ? cx - 1 : 0; (i <= cx + 1)&&(i < cols); i++)blockStart[j * cols + i + 1]++;
+		}
+	}
+	for(cell=0;cell<cells;cell++)blockStart[cell + 1] += blockStart[cell];
+	total = blockStart[cells];
+	//Reserved for the most it can take, so that it only grows with the point count
+	if(blockPoints.capacity() < (size_t)(n * 9)){
+		blockPoints.reserve(n * 9);
+		allocations++;
+	}
+	blockPoints.resize(total);
+	//Filled in index order, blockStart[cell] ends up at the next cell's start
+	for(k=0;k<n;k++){
+		cellOf(px[k], py[k], &cx, &cy);
+		for(j = cy > 0 ? cy - 1 : 0; (j <= cy + 1)&&(j < rows); j++){
+			for(i = cx > 0 ? cx - 1 : 0; (i <= cx + 1)&&(i < cols); i++)blockPoints[blockStart[j * cols + i]++] = k;
+		}
+	}
+	for(cell=cells;cell>0;cell--)blockStart[cell] = blockStart[cell - 1];
+	blockStart[0] = 0;
+}
+
+const int* SpatialGrid::getNeighbours(float x, float y, unsigned int *n) const{
+	int cx, cy, cell;
+	if(blockPoints.empty()){*n = 0; return 0;}
+	cellOf(x, y, &cx, &cy);
+	cell = cy * cols + cx;
+	*n = (unsigned int)(blockStart[cell + 1] - blockStart[cell]);
+	return &blockPoints[0] + blockStart[cell];
+}
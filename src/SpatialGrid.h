@@ -0,0 +1,63 @@
+#ifndef _SPATIALGRID_H_
+#define _SPATIALGRID_H_
+
+#include <vector>
+
+using namespace std;
+
+/*Uniform grid used for fixed-radius neighbour queries. Cells are never
+  smaller than the query radius, so every neighbour of a point lies in the
+  point's own cell or in one of the eight surrounding it. Points outside of
+  the covered area are clamped to the border cells, which keeps queries
+  exact. Storage is reused from one setup() to the next.*/
+class SpatialGrid{
+	private:
+		vector<int> head;
+		vector<int> next;
+		vector<float> px;
+		vector<float> py;
+		vector<int> blockStart;	//Per cell, the points of the 3x3 cells around it,
+		vector<int> blockPoints;	//in index order, laid out by sortCells()
+		int cols;
+		int rows;
+		float originX;
+		float originY;
+		float invCellSize;
+		unsigned int allocations;
+
+		void cellOf(float x, float y, int *cx, int *cy) const;
+
+	public:
+		SpatialGrid();
+		~SpatialGrid(){;}
+
+		/*Clears the grid and covers [x,x+width)x[y,y+height) with cells of
+		  at least cellSize. capacity is the expected number of points and
+		  bounds the number of cells.*/
+		void setup(float x, float y, float width, float height, float cellSize, unsigned int capacity);
+
+		/*Adds a point, returns its index (points are numbered in insertion order)*/
+		int insert(float x, float y);
+
+		/*True if a point other than exclude lies strictly closer than sqrt(sqRadius)*/
+		bool hasNeighbour(float x, float y, float sqRadius, int exclude) const;
+
+		/*Lists, for every cell, the points of the 3x3 cells around it in index
+		  order, with a counting sort. Each point is listed up to nine times.
+		  Call it after the last insert() and before getNeighbours().*/
+		void sortCells();
+
+		/*Points in the cells around (x,y) in increasing index order, so that a
+		  scan matches a full one and can stop early. n gets their count. They
+		  still need an exact distance test.*/
+		const int* getNeighbours(float x, float y, unsigned int *n) const;
+
+		unsigned int size() const {return (unsigned int)px.size();}
+		float getX(int ndx) const {return px[ndx];}
+		float getY(int ndx) const {return py[ndx];}
+
+		/*Number of times the grid's storage had to grow*/
+		unsigned int getAllocationCount() const {return allocations;}
+};
+
+#endif
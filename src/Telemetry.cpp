@@ -0,0 +1,196 @@
+#include "Telemetry.h"
+#include "Portability.h"
+
+#include <new>
+#include <chrono>
+#include <thread>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <process.h>
+#define getpid _getpid
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+static int64_t telemetryNow(){
+	return (int64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+/*******************************Segments*********************************/
+
+//Maps a segment of sizeof(TelemetryBlock) bytes, creating it for writers
+static TelemetryBlock* mapSegment(const char *name, bool create, void **handle){
+	*handle = 0;
+#ifdef _WIN32
+	char local[80];
+	snprintf(local, sizeof(local), "Local\\%s", name[0] == '/' ? name + 1 : name);
+	HANDLE h = create ? CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(TelemetryBlock), local)
+		: OpenFileMappingA(FILE_MAP_READ, FALSE, local);
+	if(!h)return 0;
+	void *p = MapViewOfFile(h, create ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, sizeof(TelemetryBlock));
+	if(!p){CloseHandle(h); return 0;}
+	*handle = h;
+	return (TelemetryBlock*)p;
+#else
+	char path[80];
+	struct stat st;
+	snprintf(path, sizeof(path), "%s%s", name[0] == '/' ? "" : "/", name);
+	int fd = create ? shm_open(path, O_CREAT | O_RDWR, 0644) : shm_open(path, O_RDONLY, 0);
+	if(fd < 0)return 0;
+	if(create && (ftruncate(fd, sizeof(TelemetryBlock)) != 0)){::close(fd); return 0;}
+	if(!create && ((fstat(fd, &st) != 0)||(st.st_size < (off_t)sizeof(TelemetryBlock)))){::close(fd); return 0;}
+	void *p = mmap(0, sizeof(TelemetryBlock), create ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	return p == MAP_FAILED ? 0 : (TelemetryBlock*)p;
+#endif
+}
+
+static void unmapSegment(TelemetryBlock *block, void *handle){
+#ifdef _WIN32
+	UnmapViewOfFile(block);
+	if(handle)CloseHandle((HANDLE)handle);
+#else
+	(void)handle;
+	munmap(block, sizeof(TelemetryBlock));
+#endif
+}
+
+/*******************************Publisher*********************************/
+
+TelemetryPublisher::TelemetryPublisher(){
+	block = 0;
+	handle = 0;
+	name[0] = 0;
+	lastUpdate = 0;
+	fps = 0.;
+	error[0] = 0;
+}
+
+TelemetryPublisher::~TelemetryPublisher(){
+	close();
+}
+
+char TelemetryPublisher::open(int instance){
+	if(block)return 1;
+	snprintf(name, sizeof(name), "/%s%u.%d", TELEMETRY_PREFIX, (unsigned int)getpid(), instance);
+	block = mapSegment(name, true, &handle);
+	if(!block){
+		strcpy_s(error, 255, "TelemetryPublisher::open failed: could not create shared memory");
+		name[0] = 0;
+		return 0;
+	}
+	memset((void*)&block->data, 0, sizeof(TelemetryData));
+	new(&block->sequence) std::atomic<uint32_t>(0);
+	block->version = TELEMETRY_VERSION;
+	block->size = sizeof(TelemetryBlock);
+	block->pid = (uint32_t)getpid();
+	block->instance = instance;
+	std::atomic_thread_fence(std::memory_order_release);
+	block->magic = TELEMETRY_MAGIC;
+	lastUpdate = 0;
+	fps = 0.;
+	return 1;
+}
+
+void TelemetryPublisher::close(){
+	if(!block)return;
+	block->magic = 0;
+	unmapSegment(block, handle);
+#ifndef _WIN32
+	shm_unlink(name);
+#endif
+	block = 0;
+	handle = 0;
+	name[0] = 0;
+}
+
+void TelemetryPublisher::publish(const FlowStats &stats){
+	if(!block)return;
+
+	//Frame rate smoothed over about a second
+	int64_t now = telemetryNow();
+	if(lastUpdate && (now > lastUpdate)){
+		double dt = (double)(now - lastUpdate) * 0.000001;
+		double alpha = dt < 1. ? dt : 1.;
+		fps = fps > 0. ? fps + alpha * (1. / dt - fps) : 1. / dt;
+	}
+	lastUpdate = now;
+
+	uint32_t s = block->sequence.load(std::memory_order_relaxed);
+	block->sequence.store(s + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	TelemetryData &d = block->data;
+	d.fps = fps;
+	d.p50 = stats.latency.getPercentile(0.5);
+	d.p95 = stats.latency.getPercentile(0.95);
+	d.p99 = stats.latency.getPercentile(0.99);
+	d.updated = now;
+	d.frames = stats.frames;
+	d.features = stats.features;
+	d.vectors = stats.vectors;
+	d.goodVectors = stats.goodVectors;
+	d.stageCount = stats.stageCount;
+	for(int i=0;i<stats.stageCount;i++){
+		strcpy_s(d.stages[i].name, TELEMETRY_NAME_LENGTH, stats.names[i]);
+		d.stages[i].last = stats.last[i];
+		d.stages[i].mean = stats.getMean(i);
+		d.stages[i].max = stats.max[i];
+	}
+
+	block->sequence.store(s + 2, std::memory_order_release);
+}
+
+/*******************************Reader*********************************/
+
+TelemetryReader::TelemetryReader(){
+	block = 0;
+	handle = 0;
+	error[0] = 0;
+}
+
+TelemetryReader::~TelemetryReader(){
+	close();
+}
+
+char TelemetryReader::open(const char *name){
+	close();
+	if(!name){strcpy_s(error, 255, "TelemetryReader::open failed"); return 0;}
+	block = mapSegment(name, false, &handle);
+	if(!block){strcpy_s(error, 255, "TelemetryReader::open failed: no such segment"); return 0;}
+	if((block->magic != TELEMETRY_MAGIC)||(block->version != TELEMETRY_VERSION)||(block->size != sizeof(TelemetryBlock))){
+		strcpy_s(error, 255, "TelemetryReader::open failed: not a cv.jit.flow segment, or another version");
+		close();
+		return 0;
+	}
+	return 1;
+}
+
+void TelemetryReader::close(){
+	if(!block)return;
+	unmapSegment(block, handle);
+	block = 0;
+	handle = 0;
+}
+
+char TelemetryReader::read(TelemetryData &data){
+	if(!block){strcpy_s(error, 255, "TelemetryReader::read failed: not open"); return 0;}
+	for(int tries=0;tries<1000;tries++){
+		uint32_t before = block->sequence.load(std::memory_order_acquire);
+		if(before & 1){
+			std::this_thread::yield();
+			continue;
+		}
+		memcpy(&data, (const void*)&block->data, sizeof(TelemetryData));
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if(block->sequence.load(std::memory_order_relaxed) == before)return 1;
+	}
+	strcpy_s(error, 255, "TelemetryReader::read failed: segment busy");
+	return 0;
+}
@@ -0,0 +1,95 @@
+#ifndef _TELEMETRY_H_
+#define _TELEMETRY_H_
+
+#include "FlowStats.h"
+
+#include <stdint.h>
+#include <atomic>
+
+#define TELEMETRY_MAGIC 0x54465643	//"CVFT"
+#define TELEMETRY_VERSION 1
+#define TELEMETRY_PREFIX "cvflow."		//Segments are named /cvflow.<pid>.<instance>
+#define TELEMETRY_NAME_LENGTH 32
+
+struct TelemetryStage{
+	char name[TELEMETRY_NAME_LENGTH];
+	double last;	//Milliseconds
+	double mean;
+	double max;
+};
+
+//What a reader gets, copied out of the block as a whole
+struct TelemetryData{
+	double fps;				//Frames per second over the last second or so
+	double p50;				//processFrame latency percentiles, milliseconds
+	double p95;
+	double p99;
+	int64_t updated;		//Microseconds since the epoch
+	uint32_t frames;
+	uint32_t features;
+	uint32_t vectors;
+	uint32_t goodVectors;
+	int32_t stageCount;
+	TelemetryStage stages[FLOW_STATS_MAX_STAGES];
+};
+
+/*Layout of the shared segment. The writer bumps sequence to an odd value,
+  updates data and bumps it again; readers retry while it is odd or has
+  changed during their copy. Nothing ever blocks the writer.*/
+struct TelemetryBlock{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;			//sizeof(TelemetryBlock)
+	uint32_t pid;
+	int32_t instance;
+	std::atomic<uint32_t> sequence;
+	TelemetryData data;
+};
+
+//Writer side, one per tracker. The segment is removed on close().
+class TelemetryPublisher{
+	private:
+		TelemetryBlock *block;
+		void *handle;
+		char name[64];
+		int64_t lastUpdate;
+		double fps;
+		char error[256];
+
+	public:
+		TelemetryPublisher();
+		~TelemetryPublisher();
+
+		char open(int instance);
+		void close();
+		bool isOpen(){return block != 0;}
+		const char* getName(){return name;}
+
+		void publish(const FlowStats &stats);
+
+		const char* getErrorMess(){return error;}
+};
+
+//Reader side, for monitoring tools
+class TelemetryReader{
+	private:
+		TelemetryBlock *block;
+		void *handle;
+		char error[256];
+
+	public:
+		TelemetryReader();
+		~TelemetryReader();
+
+		char open(const char *name);
+		void close();
+
+		//Consistent copy of the data, 0 if the writer kept it busy
+		char read(TelemetryData &data);
+		uint32_t getPid(){return block ? block->pid : 0;}
+		int getInstance(){return block ? block->instance : 0;}
+
+		const char* getErrorMess(){return error;}
+};
+
+#endif
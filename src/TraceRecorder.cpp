@@ -0,0 +1,178 @@
+#include "TraceRecorder.h"
+#include "Portability.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <set>
+#include <utility>
+
+TraceRecorder::TraceRecorder(){
+	recording = false;
+	threadCount = 0;
+	error[0] = 0;
+}
+
+TraceRecorder& TraceRecorder::get(){
+	static TraceRecorder recorder;
+	return recorder;
+}
+
+TraceContext& TraceRecorder::getContext(){
+	static thread_local TraceContext context = {0, 0};
+	return context;
+}
+
+//Returns a thread's buffer to the recorder when the thread exits
+struct TraceBufferHandle{
+	TraceBuffer *buffer;
+	~TraceBufferHandle(){
+		if(!buffer)return;
+		TraceRecorder &r = TraceRecorder::get();
+		std::lock_guard<std::mutex> lock(r.mutex);
+		r.freeBuffers.push_back(buffer);
+	}
+};
+
+//The calling thread's buffer, taken on first use. Threads that start
+//adding events while recording size theirs on the spot.
+TraceBuffer* TraceRecorder::getBuffer(){
+	static thread_local TraceBufferHandle handle = {0};
+	if(handle.buffer)return handle.buffer;
+	std::lock_guard<std::mutex> lock(mutex);
+	if(!freeBuffers.empty()){
+		handle.buffer = freeBuffers.back();
+		freeBuffers.pop_back();
+		return handle.buffer;
+	}
+	TraceBuffer *b = new TraceBuffer();
+	b->next = 0;
+	b->count = 0;
+	if(recording)b->events.resize(TRACE_CAPACITY);
+	buffers.push_back(b);
+	handle.buffer = b;
+	return b;
+}
+
+void TraceRecorder::start(){
+	std::lock_guard<std::mutex> lock(mutex);
+	for(size_t i=0;i<buffers.size();i++){
+		std::lock_guard<std::mutex> bufferLock(buffers[i]->mutex);
+		if(buffers[i]->events.size() < TRACE_CAPACITY)buffers[i]->events.resize(TRACE_CAPACITY);
+		buffers[i]->next = 0;
+		buffers[i]->count = 0;
+	}
+	recording = true;
+}
+
+void TraceRecorder::stop(){
+	recording = false;
+}
+
+void TraceRecorder::clear(){
+	std::lock_guard<std::mutex> lock(mutex);
+	for(size_t i=0;i<buffers.size();i++){
+		std::lock_guard<std::mutex> bufferLock(buffers[i]->mutex);
+		buffers[i]->next = 0;
+		buffers[i]->count = 0;
+	}
+}
+
+int TraceRecorder::newInstance(const char *kind){
+	char label[256];
+	std::lock_guard<std::mutex> lock(mutex);
+	int id = (int)instances.size() + 1;
+	snprintf(label, sizeof(label), "%s %d", kind, id);
+	instances.push_back(label);
+	return id;
+}
+
+unsigned int TraceRecorder::getThread(){
+	static thread_local unsigned int thread = 0;
+	if(!thread)thread = ++threadCount;
+	return thread;
+}
+
+void TraceRecorder::setThreadName(const char *name){
+	unsigned int thread = getThread();
+	std::lock_guard<std::mutex> lock(mutex);
+	if(threads.size() < thread)threads.resize(thread);
+	threads[thread - 1] = name;
+}
+
+void TraceRecorder::add(const char *name, const TraceContext &context, int64 start, int64 end){
+	unsigned int thread = getThread();
+	TraceBuffer *b = getBuffer();
+	std::lock_guard<std::mutex> lock(b->mutex);
+	if(!recording || b->events.empty())return;
+	TraceEvent &e = b->events[b->next];
+	e.name = name;
+	e.context = context;
+	e.thread = thread;
+	e.start = start;
+	e.end = end;
+	b->next = (b->next + 1) % b->events.size();
+	if(b->count < b->events.size())b->count++;
+}
+
+static bool startsBefore(const TraceEvent &a, const TraceEvent &b){
+	return a.start < b.start;
+}
+
+//Names are static identifiers and labels are built from them, neither
+//needs escaping.
+char TraceRecorder::write(const char *path){
+	std::vector<TraceEvent> copy;
+	std::vector<std::string> instanceLabels, threadNames;
+	size_t i;
+
+	if((!path)||(!path[0])){strcpy_s(error, 255, "TraceRecorder::write failed: no file name"); return 0;}
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for(size_t b=0;b<buffers.size();b++){
+			TraceBuffer *buffer = buffers[b];
+			std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+			if(!buffer->count)continue;
+			size_t size = buffer->events.size();
+			size_t first = (buffer->next + size - buffer->count) % size;
+			for(i=0;i<buffer->count;i++)copy.push_back(buffer->events[(first + i) % size]);
+		}
+		instanceLabels = instances;
+		threadNames = threads;
+	}
+	std::stable_sort(copy.begin(), copy.end(), startsBefore);
+
+	FILE *f = fopen(path, "w");
+	if(!f){strcpy_s(error, 255, "TraceRecorder::write failed: could not open file"); return 0;}
+
+	double us = 1000000. / cv::getTickFrequency();
+	std::set<int> pids;
+	std::set<std::pair<int, unsigned int> > tids;
+	bool first = true;
+
+	fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	for(i=0;i<copy.size();i++){
+		const TraceEvent &e = copy[i];
+		fprintf(f, "%s{\"name\":\"%s\",\"cat\":\"cvflow\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%u,\"args\":{\"frame\":%u}}",
+			first ? "" : ",\n", e.name, (double)e.start * us, (double)(e.end - e.start) * us,
+			e.context.instance, e.thread, e.context.frame);
+		first = false;
+		pids.insert(e.context.instance);
+		tids.insert(std::make_pair(e.context.instance, e.thread));
+	}
+	//Metadata: instance and thread names
+	for(std::set<int>::iterator p=pids.begin();p!=pids.end();++p){
+		int id = *p;
+		const char *label = (id > 0 && id <= (int)instanceLabels.size()) ? instanceLabels[id - 1].c_str() : "cv.jit.flow";
+		fprintf(f, "%s{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":0,\"args\":{\"name\":\"%s\"}}", first ? "" : ",\n", id, label);
+		first = false;
+	}
+	for(std::set<std::pair<int, unsigned int> >::iterator t=tids.begin();t!=tids.end();++t){
+		unsigned int thread = t->second;
+		if((thread > threadNames.size())||threadNames[thread - 1].empty())continue;
+		fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%u,\"args\":{\"name\":\"%s\"}}", first ? "" : ",\n", t->first, thread, threadNames[thread - 1].c_str());
+		first = false;
+	}
+	fprintf(f, "\n]}\n");
+	if(fclose(f) != 0){strcpy_s(error, 255, "TraceRecorder::write failed: could not write file"); return 0;}
+	return 1;
+}
@@ -0,0 +1,129 @@
+#ifndef _TRACERECORDER_H_
+#define _TRACERECORDER_H_
+
+#include "opencv.hpp"
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <string>
+
+#define TRACE_CAPACITY 16384	//Events kept per thread, the oldest are overwritten
+
+//Which tracker instance and frame the current thread is working on
+struct TraceContext{
+	int instance;
+	unsigned int frame;
+};
+
+//One stage of one frame, on one thread
+struct TraceEvent{
+	const char *name;		//Static string
+	TraceContext context;
+	unsigned int thread;
+	int64 start;			//cv::getTickCount() ticks
+	int64 end;
+};
+
+//Ring of the events of one thread
+struct TraceBuffer{
+	std::mutex mutex;		//Only contended while start(), clear() or write() run
+	std::vector<TraceEvent> events;
+	size_t next;
+	size_t count;
+};
+
+/*Recorder of stage timelines, written out in the Chrome trace event
+  format (chrome://tracing, Perfetto). There is one per binary, so in Max
+  each external records and writes its own file. Timestamps are taken
+  from the system-wide cv::getTickCount() clock rather than from start(),
+  so files written by different externals line up. Each tracker instance
+  shows as a process, with a row per thread it used. Recording is off
+  until start(). Each thread adds events to a fixed ring buffer of its
+  own, so threads do not wait on each other, and a long session only
+  keeps the last TRACE_CAPACITY stages of each thread. write() merges
+  the buffers in time order.*/
+class TraceRecorder{
+	private:
+		std::atomic<bool> recording;
+		std::mutex mutex;		//Guards the lists below
+		//One per live thread that added events. A thread that exits leaves
+		//its buffer, events included, to the next new thread.
+		std::vector<TraceBuffer*> buffers;
+		std::vector<TraceBuffer*> freeBuffers;
+		std::vector<std::string> instances;		//Labels, index is instance - 1
+		std::vector<std::string> threads;		//Names, index is thread - 1
+		std::atomic<unsigned int> threadCount;
+		char error[256];
+
+		TraceRecorder();
+		TraceBuffer* getBuffer();
+		friend struct TraceBufferHandle;
+
+	public:
+		static TraceRecorder& get();
+
+		void start();	//Clears the buffers
+		void stop();
+		bool isRecording(){return recording.load(std::memory_order_relaxed);}
+
+		//Writes the buffered events, recording continues
+		char write(const char *path);
+		void clear();
+
+		//Returns the id for a new instance, labelled "<kind> <id>"
+		int newInstance(const char *kind);
+		//Small id of the calling thread, 1-based
+		unsigned int getThread();
+		void setThreadName(const char *name);
+		void add(const char *name, const TraceContext &context, int64 start, int64 end);
+
+		static TraceContext& getContext();
+
+		const char* getErrorMess(){return error;}
+};
+
+//Records the enclosing scope as one event when recording is on
+class TraceScope{
+	private:
+		const char *name;
+		TraceContext context;
+		int64 start;
+	public:
+		TraceScope(const char *n){
+			if(TraceRecorder::get().isRecording()){
+				name = n;
+				context = TraceRecorder::getContext();
+				start = cv::getTickCount();
+			}
+			else name = 0;
+		}
+		~TraceScope(){
+			if(name)TraceRecorder::get().add(name, context, start, cv::getTickCount());
+		}
+};
+
+/*Sets the calling thread's context for the enclosing scope. Inside a
+  scope that already has the same instance, the outer frame number is
+  kept, so that a tracker called from its Jitter object reports the
+  object's frame number.*/
+class TraceFrame{
+	private:
+		TraceContext previous;
+	public:
+		TraceFrame(int instance, unsigned int frame){
+			TraceContext &c = TraceRecorder::getContext();
+			previous = c;
+			if(c.instance == instance)return;
+			c.instance = instance;
+			c.frame = frame;
+		}
+		TraceFrame(const TraceContext &context){
+			TraceContext &c = TraceRecorder::getContext();
+			previous = c;
+			c = context;
+		}
+		~TraceFrame(){TraceRecorder::getContext() = previous;}
+};
+
+#endif
@@ -27,10 +27,25 @@ extern "C" {
 } //extern "C"
 #endif
 
+#include <new>
+
 #undef error
 #include "opencv.hpp"
 #include "jitOpenCV.h"
 #include "OpticalFlowTracker.h"
+#include "AsyncTracker.h"
+#include "FlowStats.h"
+#include "Profiling.h"
+
+//Stages of matrix_calc timed in the wrapper stats
+enum{
+	WRAPPER_STAGE_PROCESS,
+	WRAPPER_STAGE_OUTPUT,
+	WRAPPER_STAGE_CALC,
+	WRAPPER_STAGE_COUNT
+};
+
+static const char *const wrapperStageNames[WRAPPER_STAGE_COUNT] = {"process", "output", "matrix_calc"};
 
 typedef struct _cv_jit_flow 
 {
@@ -38,8 +53,26 @@ typedef struct _cv_jit_flow
 	double				threshold;
 	float				min_distance;
 	long				radius;
+	long				detector;
+	long				occupancy;
+	long				interval;
+	long				threads;
+	long				tilecount;
+	long				tiles[2];
+	long				predict;
+	long				globalmotion;
+	long				fbcheck;
+	float				fbthreshold;
+	float				budget;
+	long				async;
+	long				asyncdetect;
+	long				telemetry;
 	
 	OpticalFlowTracker		tracker;
+	AsyncTracker			worker;	//Runs tracker one frame behind when async is on
+	FlowResult				result;
+	FlowStats				stats;	//Timings of matrix_calc itself
+	unsigned int			frame;	//matrix_calc calls, the frame number in traces
 } t_cv_jit_flow;
 
 void *_cv_jit_flow_class;
@@ -50,6 +83,12 @@ void 				cv_jit_flow_free(t_cv_jit_flow *x);
 t_jit_err 			cv_jit_flow_matrix_calc(t_cv_jit_flow *x, void *inputs, void *outputs);
 void				cv_jit_flow_calculate(t_cv_jit_flow *x, long dimcount, long *dim, long planecount, t_jit_matrix_info *in_minfo, uchar *bip);
 void				cv_jit_flow_reset(t_cv_jit_flow *x);
+void				cv_jit_flow_getstats(t_cv_jit_flow *x, FlowStats *tracker, FlowStats *wrapper);
+void				cv_jit_flow_resetstats(t_cv_jit_flow *x);
+t_jit_err			cv_jit_flow_telemetry(t_cv_jit_flow *x, void *attr, long argc, t_atom *argv);
+void				cv_jit_flow_tracestart(t_cv_jit_flow *x);
+void				cv_jit_flow_tracestop(t_cv_jit_flow *x);
+void				cv_jit_flow_tracewrite(t_cv_jit_flow *x, t_symbol *s);
 
 t_jit_err cv_jit_flow_init(void) 
 {
@@ -72,7 +111,7 @@ t_jit_err cv_jit_flow_init(void)
    	jit_mop_output_nolink(mop,1); //Turn off output linking so that output matrix does not adapt to input
    	
    	jit_attr_setlong(output,_jit_sym_minplanecount,7);  //Seven planes, holding a motion vector
-  	jit_attr_setlong(output,_jit_sym_maxplanecount,7);
+  	jit_attr_setlong(output,_jit_sym_maxplanecount,8);  //Plus the forward-backward error when fbcheck is on
   	jit_attr_setlong(output,_jit_sym_mindim,1); //Only one dimension
   	jit_attr_setlong(output,_jit_sym_maxdim,1);
   	jit_attr_setsym(output,_jit_sym_types,_jit_sym_float32); //Coordinates are returned with sub-pixel accuracy
@@ -83,6 +122,11 @@ t_jit_err cv_jit_flow_init(void)
 	//add methods
 	jit_class_addmethod(_cv_jit_flow_class, (method)cv_jit_flow_matrix_calc,(char *)"matrix_calc",A_CANT, 0L);
 	jit_class_addmethod(_cv_jit_flow_class, (method)cv_jit_flow_reset,(char *)"reset",0L);	
+	jit_class_addmethod(_cv_jit_flow_class, (method)cv_jit_flow_getstats,(char *)"getstats",A_CANT,0L);
+	jit_class_addmethod(_cv_jit_flow_class, (method)cv_jit_flow_resetstats,(char *)"resetstats",0L);
+	jit_class_addmethod(_cv_jit_flow_class, (method)cv_jit_flow_tracestart,(char *)"tracestart",0L);
+	jit_class_addmethod(_cv_jit_flow_class, (method)cv_jit_flow_tracestop,(char *)"tracestop",0L);
+	jit_class_addmethod(_cv_jit_flow_class, (method)cv_jit_flow_tracewrite,(char *)"tracewrite",A_SYM,0L);
 
 	//add attributes	
 	attrflags = JIT_ATTR_GET_DEFER_LOW | JIT_ATTR_SET_USURP_LOW;
@@ -98,6 +142,58 @@ t_jit_err cv_jit_flow_init(void)
 	attr = (t_jit_object *)jit_object_new(	_jit_sym_jit_attr_offset,"radius",_jit_sym_long,attrflags,(method)0L,(method)0L,calcoffset(t_cv_jit_flow,radius));			
 	jit_attr_addfilterset_clip(attr,1,0,TRUE,FALSE);	//Must be at least 1
 	jit_class_addattr(_cv_jit_flow_class, attr);
+	//detector: 0 = Shi-Tomasi, 1 = FAST
+	attr = (t_jit_object *)jit_object_new(	_jit_sym_jit_attr_offset,"detector",_jit_sym_long,attrflags,(method)0L,(method)0L,calcoffset(t_cv_jit_flow,detector));			
+	jit_attr_addfilterset_clip(attr,FEATURE_ALGO_EIGENVALS,FEATURE_ALGO_FAST,TRUE,TRUE);
+	jit_class_addattr(_cv_jit_flow_class, attr);
+	//occupancy: only detect away from existing tracks (off by default)
+	attr = (t_jit_object *)jit_object_new(	_jit_sym_jit_attr_offset,"occupancy",_jit_sym_long,attrflags,(method)0L,(method)0L,calcoffset(t_cv_jit_flow,occupancy));			
+	jit_attr_addfilterset_clip(attr,0,1,TRUE,TRUE);
+	jit_class_addattr(_cv_jit_flow_class, attr);
+	//interval: detect new features every n frames
+	attr = (t_jit_object *)jit_object_new(	_jit_sym_jit_attr_offset,"interval",_jit_sym_long,attrflags,(method)0L,(method)0L,calcoffset(t_cv_jit_flow,interval));			
+	jit_attr_addfilterset_clip(attr,1,0,TRUE,FALSE);	//Must be at least 1
+	jit_class_addattr(_cv_jit_flow_class, attr);
+	//threads: number of concurrent tracking batches, 0 = automatic
+	attr = (t_jit_object *)jit_object_new(	_jit_sym_jit_attr_offset,"threads",_jit_sym_long,attrflags,(method)0L,(method)0L,calcoffset(t_cv_jit_flow,threads));			
+	jit_attr_addfilterset_clip(attr,0,0,TRUE,FALSE);	//clip to 0
+	jit_class_addattr(_cv_jit_flow_class, attr);
+	//tiles: columns and rows of the detection grid
+	attr = (t_jit_object *)jit_object_new(	_jit_sym_jit_attr_offset_array,"tiles",_jit_sym_long,2,attrflags,(method)0L,(method)0L,calcoffset(t_cv_jit_flow,tilecount),calcoffset(t_cv_jit_flow,tiles));			
+	jit_attr_addfilterset_clip(attr,1,0,TRUE,FALSE);	//Must be at least 1
+	jit_class_addattr(_cv_jit_flow_class, attr);
+	//predict: start tracking from each track's predicted position
+	attr = (t_jit_object *)jit_object_new(	_jit_sym_jit_attr_offset,"predict",_jit_sym_long,attrflags,(method)0L,(method)0L,calcoffset(t_cv_jit_flow,predict));			
+	jit_attr_addfilterset_clip(attr,0,1,TRUE,TRUE);
+	jit_class_addattr(_cv_jit_flow_class, attr);
+	//globalmotion: seed tracking with the translation of the whole frame
+	attr = (t_jit_object *)jit_object_new(	_jit_sym_jit_attr_offset,"globalmotion",_jit_sym_long,attrflags,(method)0L,(method)0L,calcoffset(t_cv_jit_flow,globalmotion));			
+	jit_attr_addfilterset_clip(attr,0,1,TRUE,TRUE);
+	jit_class_addattr(_cv_jit_flow_class, attr);
+	//fbcheck: drop tracks that do not survive tracking back to the previous frame
+	attr = (t_jit_object *)jit_object_new(	_jit_sym_jit_attr_offset,"fbcheck",_jit_sym_long,attrflags,(method)0L,(method)0L,calcoffset(t_cv_jit_flow,fbcheck));			
+	jit_attr_addfilterset_clip(attr,0,1,TRUE,TRUE);
+	jit_class_addattr(_cv_jit_flow_class, attr);
+	//fbthreshold: largest round-trip error in pixels
+	attr = (t_jit_object *)jit_object_new(	_jit_sym_jit_attr_offset,"fbthreshold",_jit_sym_float32,attrflags,(method)0L,(method)0L,calcoffset(t_cv_jit_flow,fbthreshold));			
+	jit_attr_addfilterset_clip(attr,0,0,TRUE,FALSE);	//clip to 0
+	jit_class_addattr(_cv_jit_flow_class, attr);
+	//async: process on a worker thread, output is one frame late
+	attr = (t_jit_object *)jit_object_new(	_jit_sym_jit_attr_offset,"async",_jit_sym_long,attrflags,(method)0L,(method)0L,calcoffset(t_cv_jit_flow,async));			
+	jit_attr_addfilterset_clip(attr,0,1,TRUE,TRUE);
+	jit_class_addattr(_cv_jit_flow_class, attr);
+	//asyncdetect: detect features on a background thread
+	attr = (t_jit_object *)jit_object_new(	_jit_sym_jit_attr_offset,"asyncdetect",_jit_sym_long,attrflags,(method)0L,(method)0L,calcoffset(t_cv_jit_flow,asyncdetect));			
+	jit_attr_addfilterset_clip(attr,0,1,TRUE,TRUE);
+	jit_class_addattr(_cv_jit_flow_class, attr);
+	//telemetry: publish stats to shared memory for cvflow_stat
+	attr = (t_jit_object *)jit_object_new(	_jit_sym_jit_attr_offset,"telemetry",_jit_sym_long,attrflags,(method)0L,(method)cv_jit_flow_telemetry,calcoffset(t_cv_jit_flow,telemetry));			
+	jit_attr_addfilterset_clip(attr,0,1,TRUE,TRUE);
+	jit_class_addattr(_cv_jit_flow_class, attr);
+	//budget: milliseconds per frame, 0 = no limit
+	attr = (t_jit_object *)jit_object_new(	_jit_sym_jit_attr_offset,"budget",_jit_sym_float32,attrflags,(method)0L,(method)0L,calcoffset(t_cv_jit_flow,budget));			
+	jit_attr_addfilterset_clip(attr,0,0,TRUE,FALSE);	//clip to 0
+	jit_class_addattr(_cv_jit_flow_class, attr);
 			
 	err=jit_class_register(_cv_jit_flow_class);
 
@@ -106,7 +202,53 @@ t_jit_err cv_jit_flow_init(void)
 
 void cv_jit_flow_reset(t_cv_jit_flow *x)
 {
-	x->tracker.reset();
+	x->worker.reset();
+	x->result.count = 0;
+}
+
+//Copies the tracker and wrapper stats, either pointer may be NULL
+void cv_jit_flow_getstats(t_cv_jit_flow *x, FlowStats *tracker, FlowStats *wrapper)
+{
+	if(tracker)x->worker.getStats(*tracker);
+	if(wrapper)*wrapper = x->stats;
+}
+
+void cv_jit_flow_resetstats(t_cv_jit_flow *x)
+{
+	x->worker.resetStats();
+	x->stats.reset();
+}
+
+//Turning telemetry off removes the segment without waiting for a frame
+t_jit_err cv_jit_flow_telemetry(t_cv_jit_flow *x, void *attr, long argc, t_atom *argv)
+{
+	(void)attr;
+	if(x){
+		x->telemetry = (argc && argv && jit_atom_getlong(argv)) ? 1 : 0;
+		if(!x->telemetry)x->worker.closeTelemetry();
+	}
+	return JIT_ERR_NONE;
+}
+
+//The trace recorder is shared by the cv.jit.flow instances only: every
+//external has its own, and tracewrite writes this one's timelines.
+void cv_jit_flow_tracestart(t_cv_jit_flow *x)
+{
+	(void)x;
+	TraceRecorder::get().start();
+}
+
+void cv_jit_flow_tracestop(t_cv_jit_flow *x)
+{
+	(void)x;
+	TraceRecorder::get().stop();
+}
+
+//Writes the recorded timelines as Chrome trace JSON
+void cv_jit_flow_tracewrite(t_cv_jit_flow *x, t_symbol *s)
+{
+	(void)x;
+	if(!TraceRecorder::get().write(s ? s->s_name : 0))error("cv.jit.flow: %s", TraceRecorder::get().getErrorMess());
 }
 
 t_jit_err cv_jit_flow_matrix_calc(t_cv_jit_flow *x, void *inputs, void *outputs)
@@ -116,12 +258,11 @@ t_jit_err cv_jit_flow_matrix_calc(t_cv_jit_flow *x, void *inputs, void *outputs)
 	t_jit_matrix_info in_minfo,out_minfo;
 	uchar *out_bp, *in_bp;
 	void *in_matrix,*out_matrix;
-	unsigned int i;
-	float *out_data;
 	int result;
-	//CvPoint2D32f* f;
-	Vector* v;
+	unsigned int count, planes;
 	CvMat image;
+	FlowSettings settings;
+	StageTimer timer, calcTimer;
 			
 	//Get pointers to matrices
 	in_matrix 	= jit_object_method(inputs,_jit_sym_getindex,0);
@@ -129,6 +270,11 @@ t_jit_err cv_jit_flow_matrix_calc(t_cv_jit_flow *x, void *inputs, void *outputs)
 
 	if (x&&in_matrix&&out_matrix) 
 	{
+		//The worker owns the tracker in async mode, so frames are counted here;
+		//the tracker and its worker threads keep this frame number
+		CVFLOW_FRAME(x->tracker.getTraceId(), x->frame++);
+		CVFLOW_TASK("matrix_calc");
+		
 		//Lock the matrices
 		
 		in_savelock = reinterpret_cast<long>(jit_object_method(in_matrix,_jit_sym_lock,1));
@@ -165,39 +311,69 @@ t_jit_err cv_jit_flow_matrix_calc(t_cv_jit_flow *x, void *inputs, void *outputs)
 		
 		image = jitMatrix2CvMat(in_matrix);
 		
-		x->tracker.setDetectorThreshold((float)x->threshold);
-		x->tracker.setMinDistance(x->min_distance);
-		x->tracker.setWindowSize(x->radius);
-		x->tracker.setMaxAge(3);
+		//All settings travel together with the frame
+		settings.threshold = (float)x->threshold;
+		settings.minDistance = x->min_distance;
+		settings.radius = x->radius;
+		settings.detector = x->detector;
+		settings.occupancy = x->occupancy != 0;
+		settings.interval = x->interval;
+		settings.threads = x->threads;
+		settings.tileCols = x->tiles[0];
+		settings.tileRows = x->tilecount > 1 ? x->tiles[1] : x->tiles[0];
+		settings.predict = x->predict != 0;
+		settings.globalMotion = x->globalmotion != 0;
+		settings.fbCheck = x->fbcheck != 0;
+		settings.fbThreshold = x->fbthreshold;
+		settings.budget = x->budget;
+		settings.asyncDetection = x->asyncdetect != 0;
+		settings.telemetry = x->telemetry != 0;
+		settings.planes = x->fbcheck ? 8 : 7;
 		
-		result = x->tracker.processFrame(&image);
-		if(!result){
-			error("Could not process frame: %s", x->tracker.getErrorMess());
-			err=JIT_ERR_GENERIC;
-			goto out;
+		timer.lap();
+		if(x->async){
+			//Output the last completed frame, this one is processed meanwhile
+			if(!x->worker.start() || !x->worker.submit(&image, settings) || !x->worker.getResult(x->result)){
+				error("Could not process frame: %s", x->worker.getErrorMess());
+				err=JIT_ERR_GENERIC;
+				goto out;
+			}
+			count = x->result.count;
+			planes = x->result.planes;
+		}
+		else{
+			x->worker.stop();
+			settings.apply(x->tracker);
+			result = x->tracker.processFrame(&image);
+			if(!result){
+				error("Could not process frame: %s", x->tracker.getErrorMess());
+				err=JIT_ERR_GENERIC;
+				goto out;
+			}
+			count = x->tracker.getGoodVectorCount();
+			planes = settings.planes > 7 ? 8 : 7;
 		}
 		
-		out_minfo.dim[0] = x->tracker.getGoodVectorCount();
+		x->stats.record(WRAPPER_STAGE_PROCESS, timer.lap());
+		
+		out_minfo.dim[0] = count;
+		out_minfo.planecount = planes;
 		jit_object_method(out_matrix,_jit_sym_setinfo,&out_minfo);
 		jit_object_method(out_matrix,_jit_sym_getinfo,&out_minfo);
 		jit_object_method(out_matrix,_jit_sym_getdata,&out_bp);
 		if (!out_bp) { err=JIT_ERR_INVALID_OUTPUT; goto out;}
+		if(out_minfo.planecount != (long)planes) { err=JIT_ERR_MISMATCH_PLANE; goto out;}
 		
-		out_data = (float *)out_bp;
-		for(i=0;i<x->tracker.getVectorCount();i++){
-			if(x->tracker.isGoodVector(i)){
-				v=x->tracker.vectorAt(i);
-				out_data[0] = v->x;
-				out_data[1] = v->y;
-				out_data[2] = v->x2;
-				out_data[3] = v->y2;
-				out_data[4] = v->alpha;
-				out_data[5] = v->theta;
-				out_data[6] = (float)v->index;
-				
-				out_data += 7;
-			}
-		}				
+		//The worker's result is copied, otherwise vectors go straight from the tracker
+		if(x->async){
+			if(count)memcpy(out_bp, x->result.data, count * planes * sizeof(float));
+		}
+		else FlowResult::write(x->tracker, planes, (float*)out_bp, count);
+		x->stats.record(WRAPPER_STAGE_OUTPUT, timer.lap());
+		double t = calcTimer.lap();
+		x->stats.record(WRAPPER_STAGE_CALC, t);
+		x->stats.latency.add(t);
+		x->stats.frames++;
 	}
 
 	
@@ -223,6 +399,28 @@ t_cv_jit_flow *cv_jit_flow_new(void)
 		x->threshold = 0.01f;
 		x->radius = 7;
 		x->min_distance = 0.01f;
+		x->detector = FEATURE_ALGO_EIGENVALS;
+		x->occupancy = 0;
+		x->interval = 1;
+		x->threads = 0;
+		x->tilecount = 2;
+		x->tiles[0] = 1;
+		x->tiles[1] = 1;
+		x->predict = 0;
+		x->globalmotion = 0;
+		x->fbcheck = 0;
+		x->fbthreshold = 1.f;
+		x->budget = 0.f;
+		x->async = 0;
+		x->asyncdetect = 0;
+		x->telemetry = 0;
+		x->frame = 0;
+		
+		new(&x->tracker) OpticalFlowTracker();
+		new(&x->worker) AsyncTracker(&x->tracker);
+		new(&x->result) FlowResult();
+		new(&x->stats) FlowStats();
+		x->stats.setStages(wrapperStageNames, WRAPPER_STAGE_COUNT);
 	} else {
 		x = NULL;
 	}	
@@ -231,5 +429,9 @@ t_cv_jit_flow *cv_jit_flow_new(void)
 
 void cv_jit_flow_free(t_cv_jit_flow *x)
 {
-	
+	//The worker thread must be stopped before the tracker goes away
+	x->worker.~AsyncTracker();
+	x->result.~FlowResult();
+	x->stats.~FlowStats();
+	x->tracker.~OpticalFlowTracker();
 }
\ No newline at end of file
@@ -23,14 +23,16 @@
 
 
 #include <stddef.h>
+#include <new>
 
 #undef error
 #include "jit.common.h"
 
 #undef error
 #include "opencv.hpp"
-
-#define MAXPOINTS 256
+#include "FlowField.h"
+#include "FlowStats.h"
+#include "Profiling.h"
 
 void cvJitter2CvMat(void *jit, CvMat *cv)
 {
@@ -75,26 +77,13 @@ typedef struct _cv_jit_flowfield
 	long			npoints;
 	long			radius;
 	long			motionthresh;
+	long			dilate;
 	long			mode;
+	long			threads;
+	long			globalmotion;
 
-	//Images for processing	
-	CvMat		*previous;
-	CvMat		*movement;
-	CvMat		*mask;
-	CvMat		*eigImage;
-	CvMat		*tmpImage;
-	CvMat		*pyr;
-	CvMat		*prevPyr;
-	CvMat		*dummy;
-
-	//Arrays for tracking
-	CvPoint2D32f	points[MAXPOINTS]; 
-	CvPoint2D32f	newPoints[MAXPOINTS];
-	char			status[MAXPOINTS];
-
-	int			pointCount;
-
-	int			flags;
+	FlowField		field;
+	LatencyHistogram	latency;	//matrix_calc, frames that were output only
 
 } t_cv_jit_flowfield;
 
@@ -104,6 +93,11 @@ t_jit_err 				cv_jit_flowfield_init(void);
 t_cv_jit_flowfield *	cv_jit_flowfield_new(void);
 void 					cv_jit_flowfield_free(t_cv_jit_flowfield *x);
 t_jit_err 				cv_jit_flowfield_matrix_calc(t_cv_jit_flowfield *x, void *inputs, void *outputs);
+void					cv_jit_flowfield_tracestart(t_cv_jit_flowfield *x);
+void					cv_jit_flowfield_tracestop(t_cv_jit_flowfield *x);
+void					cv_jit_flowfield_tracewrite(t_cv_jit_flowfield *x, t_symbol *s);
+void					cv_jit_flowfield_getlatency(t_cv_jit_flowfield *x, LatencyHistogram *field, LatencyHistogram *wrapper);
+void					cv_jit_flowfield_resetstats(t_cv_jit_flowfield *x);
 
 t_jit_err cv_jit_flowfield_init(void) 
 {
@@ -137,6 +131,11 @@ t_jit_err cv_jit_flowfield_init(void)
 	
 	//add methods
 	jit_class_addmethod(_cv_jit_flowfield_class, (method)cv_jit_flowfield_matrix_calc, 		"matrix_calc", 		A_CANT, 0L);	
+	jit_class_addmethod(_cv_jit_flowfield_class, (method)cv_jit_flowfield_tracestart, 		"tracestart", 		0L);
+	jit_class_addmethod(_cv_jit_flowfield_class, (method)cv_jit_flowfield_tracestop, 		"tracestop", 		0L);
+	jit_class_addmethod(_cv_jit_flowfield_class, (method)cv_jit_flowfield_tracewrite, 		"tracewrite", 		A_SYM, 0L);
+	jit_class_addmethod(_cv_jit_flowfield_class, (method)cv_jit_flowfield_getlatency, 		"getlatency", 		A_CANT, 0L);
+	jit_class_addmethod(_cv_jit_flowfield_class, (method)cv_jit_flowfield_resetstats, 		"resetstats", 		0L);
 
 	//add attributes	
 	attrflags = JIT_ATTR_GET_DEFER_LOW | JIT_ATTR_SET_USURP_LOW;
@@ -152,7 +151,7 @@ t_jit_err cv_jit_flowfield_init(void)
 
 	//Maximum number of features
 	attr = (t_jit_object *)jit_object_new(	_jit_sym_jit_attr_offset,"npoints",_jit_sym_long,attrflags,(method)0L,(method)0L,calcoffset(t_cv_jit_flowfield,npoints));
-	jit_attr_addfilterset_clip(attr,1,MAXPOINTS,TRUE,TRUE);	//clip to 1 - MAXPOINTS
+	jit_attr_addfilterset_clip(attr,1,MAXPOINTS,TRUE,TRUE);	//clip to 1 - MAXPOINTS (16384)
 	jit_class_addattr(_cv_jit_flowfield_class, attr);
 
 	//Radius of optical flow window
@@ -164,11 +163,26 @@ t_jit_err cv_jit_flowfield_init(void)
 	attr = (t_jit_object *)jit_object_new(	_jit_sym_jit_attr_offset,"motionthresh",_jit_sym_long,attrflags,(method)0L,(method)0L,calcoffset(t_cv_jit_flowfield,motionthresh));
 	jit_attr_addfilterset_clip(attr,0,255,TRUE,TRUE); //clip to 0 - 255
 	jit_class_addattr(_cv_jit_flowfield_class, attr);
+	
+	//Grow the motion mask by n pixels to close holes
+	attr = (t_jit_object *)jit_object_new(	_jit_sym_jit_attr_offset,"dilate",_jit_sym_long,attrflags,(method)0L,(method)0L,calcoffset(t_cv_jit_flowfield,dilate));
+	jit_attr_addfilterset_clip(attr,0,MOTIONMASK_MAX_RADIUS,TRUE,TRUE); //clip to 0 - 8
+	jit_class_addattr(_cv_jit_flowfield_class, attr);
 
 	//Threshold for motion detection
 	attr = (t_jit_object *)jit_object_new(	_jit_sym_jit_attr_offset,"mode",_jit_sym_long,attrflags,(method)0L,(method)0L,calcoffset(t_cv_jit_flowfield,mode));
 	jit_attr_addfilterset_clip(attr,0,1,TRUE,TRUE); //clip to 0 - 1
 	jit_class_addattr(_cv_jit_flowfield_class, attr);
+
+	//Number of concurrent tracking batches, 0 = automatic
+	attr = (t_jit_object *)jit_object_new(	_jit_sym_jit_attr_offset,"threads",_jit_sym_long,attrflags,(method)0L,(method)0L,calcoffset(t_cv_jit_flowfield,threads));
+	jit_attr_addfilterset_clip(attr,0,0,TRUE,FALSE); //clip to 0
+	jit_class_addattr(_cv_jit_flowfield_class, attr);
+
+	//Seed tracking with the translation of the whole frame
+	attr = (t_jit_object *)jit_object_new(	_jit_sym_jit_attr_offset,"globalmotion",_jit_sym_long,attrflags,(method)0L,(method)0L,calcoffset(t_cv_jit_flowfield,globalmotion));
+	jit_attr_addfilterset_clip(attr,0,1,TRUE,TRUE); //clip to 0 - 1
+	jit_class_addattr(_cv_jit_flowfield_class, attr);
 	
 	
 	jit_class_register(_cv_jit_flowfield_class);
@@ -176,6 +190,40 @@ t_jit_err cv_jit_flowfield_init(void)
 	return JIT_ERR_NONE;
 }
 
+//The trace recorder is shared by the cv.jit.flowfield instances only: every
+//external has its own, and tracewrite writes this one's timelines.
+void cv_jit_flowfield_tracestart(t_cv_jit_flowfield *x)
+{
+	(void)x;
+	TraceRecorder::get().start();
+}
+
+void cv_jit_flowfield_tracestop(t_cv_jit_flowfield *x)
+{
+	(void)x;
+	TraceRecorder::get().stop();
+}
+
+//Writes the recorded timelines as Chrome trace JSON
+void cv_jit_flowfield_tracewrite(t_cv_jit_flowfield *x, t_symbol *s)
+{
+	(void)x;
+	if(!TraceRecorder::get().write(s ? s->s_name : 0))error("cv.jit.flowfield: %s", TraceRecorder::get().getErrorMess());
+}
+
+//Copies the processFrame and matrix_calc latencies, either may be NULL
+void cv_jit_flowfield_getlatency(t_cv_jit_flowfield *x, LatencyHistogram *field, LatencyHistogram *wrapper)
+{
+	if(field)*field = x->field.getLatency();
+	if(wrapper)*wrapper = x->latency;
+}
+
+void cv_jit_flowfield_resetstats(t_cv_jit_flowfield *x)
+{
+	x->field.resetLatency();
+	x->latency.reset();
+}
+
 t_jit_err cv_jit_flowfield_matrix_calc(t_cv_jit_flowfield *x, void *inputs, void *outputs)
 {
 	t_jit_err				err=JIT_ERR_NONE;
@@ -183,15 +231,12 @@ t_jit_err cv_jit_flowfield_matrix_calc(t_cv_jit_flowfield *x, void *inputs, void
 	t_jit_matrix_info		in_minfo,out_minfo;
 	char					*out_bp, *in_bp;
 	void					*in_matrix,*out_matrix;
-	int						i,j,k;
-	float					dx,dy;
-	float					t,td,tr;
+	int						i;
 	float					*out_data;
 	CvMat					source;
 	int						featureCount;
-	CvSize					window;
-
-	int		nClusters = 0;
+	CvPoint2D32f			*points, *newPoints;
+	StageTimer				calcTimer;
 	
 	//Get pointers to matrices
 	in_matrix 	= jit_object_method(inputs,_jit_sym_getindex,0);
@@ -199,6 +244,9 @@ t_jit_err cv_jit_flowfield_matrix_calc(t_cv_jit_flowfield *x, void *inputs, void
 
 	if (x&&in_matrix&&out_matrix) 
 	{
+		CVFLOW_FRAME(x->field.getTraceId(), x->field.getFrameIndex());
+		CVFLOW_TASK("matrix_calc");
+		
 		//Lock the matrices
 		in_savelock = (long) jit_object_method(in_matrix,_jit_sym_lock,1);
 		out_savelock = (long) jit_object_method(out_matrix,_jit_sym_lock,1);
@@ -230,99 +278,29 @@ t_jit_err cv_jit_flowfield_matrix_calc(t_cv_jit_flowfield *x, void *inputs, void
 		//Convert Jitter matrix to OpenCV matrix
 		cvJitter2CvMat(in_matrix, &source);
 		
-		//Adjust the size of eigImage and tempImage if need be
-		if((source.cols != x->eigImage->cols)||(source.rows != x->eigImage->rows))
-		{
-			cvReleaseMat(&(x->previous));
-			x->previous = cvCreateMat( source.rows, source.cols, CV_8UC1 );
-			cvSet(x->previous,cvScalarAll(0),NULL);
-
-			cvReleaseMat(&(x->movement));
-			x->movement = cvCreateMat( source.rows, source.cols, CV_8UC1 );
-
-			cvReleaseMat(&(x->mask));
-			x->mask = cvCreateMat( source.rows, source.cols, CV_8UC1 );
-
-			cvReleaseMat(&(x->eigImage));
-			x->eigImage = cvCreateMat( source.rows, source.cols, CV_32FC1 );
-
-			cvReleaseMat(&(x->tmpImage));
-			x->tmpImage = cvCreateMat( source.rows, source.cols, CV_32FC1 );
-
-			x->pyr = cvCreateMat( source.rows, source.cols, CV_8UC1 );
-
-			cvReleaseMat(&(x->prevPyr));
-			x->prevPyr = cvCreateMat( source.rows, source.cols, CV_8UC1 );
-
-			x->flags = 0;
-		}
-		
 		//Adjust parameters
 		x->threshold = MAX(0.001,x->threshold);
 		x->distance = MAX(1,x->distance);
-		featureCount = x->npoints;
-		window.height = window.width = x->radius * 2 + 1;
+		x->field.setThreshold(x->threshold);
+		x->field.setDistance(x->distance);
+		x->field.setMaxPoints(x->npoints);
+		x->field.setRadius(x->radius);
+		x->field.setMotionThreshold(x->motionthresh);
+		x->field.setDilation(x->dilate);
+		x->field.setMode(x->mode);
+		x->field.setThreads(x->threads);
+		x->field.setGlobalMotion(x->globalmotion != 0);
 		
 		//Calculate
-		//
-		//Frame Differencing
-		cvAbsDiff(&source,x->previous,x->movement);
-		//
-		//Threshold to obtain binary mask
-		cvThreshold(x->movement,x->mask,x->motionthresh,255,CV_THRESH_BINARY);
-		//
-		
-		//
-
-		if(x->mode == 1)  //Use features from previous pass
-		{
-			CvPoint2D32f tempPoints[MAXPOINTS];
-
-			//Find strong features only in areas where movement was detected
-			cvGoodFeaturesToTrack( &source, x->eigImage, x->tmpImage, tempPoints, &featureCount, x->threshold, x->distance, x->mask, 3, 0, 0.04 );
-
-			for(i=0,j=0;i<x->pointCount;i++)
-			{
-				if(x->status[i] == 1)
-				{
-					x->points[i] = x->newPoints[i];
-				}
-				else
-				{
-					if(j<featureCount)
-					{
-						x->points[i] = tempPoints[j];
-						j++;
-					}
-				}
-			}
-			for(;(j<featureCount)&&(i<x->npoints);j++,i++)
-			{
-				x->points[i] = tempPoints[j];
-			}
-
-			featureCount = i;
-		}
-		else
-		{
-			//Find strong features only in areas where movement was detected
-			cvGoodFeaturesToTrack( &source, x->eigImage, x->tmpImage, x->points, &featureCount, x->threshold, x->distance, x->mask, 3, 0, 0.04 );
-		}
-
-		//Find optical flow for detected features
-		if(featureCount > 0) //Don't process if there are no features
+		if(!x->field.processFrame(&source))
 		{
-			cvCalcOpticalFlowPyrLK( x->previous, &source, x->prevPyr, x->pyr,
-                x->points, x->newPoints, featureCount, window, 3, x->status, 0,
-                cvTermCriteria(CV_TERMCRIT_ITER|CV_TERMCRIT_EPS,20,0.03), x->flags );
-                
-			x->flags |= CV_LKFLOW_PYR_A_READY;
-			CV_SWAP(x->prevPyr,x->pyr,x->dummy);
+			error("cv.jit.flowfield: could not process frame: %s", x->field.getErrorMess());
+			err = JIT_ERR_GENERIC;
+			goto out;
 		}
-		
-		//Copy current frame for next pass
-		cvCopy(&source, x->previous, 0);
-
+		featureCount = x->field.getFeatureCount();
+		points = x->field.getPointPtr();
+		newPoints = x->field.getNewPointPtr();
 
 		//Prepare output
 		//Change dimensions of output matrix to match number of features
@@ -334,16 +312,19 @@ t_jit_err cv_jit_flowfield_matrix_calc(t_cv_jit_flowfield *x, void *inputs, void
 		
 		out_data = (float *)out_bp;
 		
-		for(i=0; i < featureCount; i++)
 		{
-			out_data[0] = x->points[i].x;
-			out_data[1] = x->points[i].y;
-			out_data[2] = x->newPoints[i].x;
-			out_data[3] = x->newPoints[i].y;
-			
-			out_data += 4;
+			CVFLOW_TASK("pack");
+			for(i=0; i < featureCount; i++)
+			{
+				out_data[0] = points[i].x;
+				out_data[1] = points[i].y;
+				out_data[2] = newPoints[i].x;
+				out_data[3] = newPoints[i].y;
+				
+				out_data += 4;
+			}
 		}
-		
+		x->latency.add(calcTimer.lap());
 	}
 
 	
@@ -368,21 +349,16 @@ t_cv_jit_flowfield *cv_jit_flowfield_new(void)
 		x->radius = 5;
 
 		x->motionthresh = 3;
+		x->dilate = 0;
 
 		x->mode = 0;
 
-		x->pointCount = 0;
-		
-		//Initialize matrices
-		x->previous = cvCreateMat( 1, 1, CV_8UC1 );
-		x->movement = cvCreateMat( 1, 1, CV_8UC1 );
-		x->mask = cvCreateMat( 1, 1, CV_8UC1 );
-		x->eigImage = cvCreateMat( 1, 1, CV_32FC1 );
-		x->tmpImage = cvCreateMat( 1, 1, CV_32FC1 );
-		x->pyr = cvCreateMat( 1, 1, CV_8UC1 );
-		x->prevPyr = cvCreateMat( 1, 1, CV_8UC1 );
+		x->threads = 0;
+
+		x->globalmotion = 0;
 
-		x->flags = 0;
+		new(&x->field) FlowField();
+		new(&x->latency) LatencyHistogram();
 
 	} else {
 		x = NULL;
@@ -392,19 +368,6 @@ t_cv_jit_flowfield *cv_jit_flowfield_new(void)
 
 void cv_jit_flowfield_free(t_cv_jit_flowfield *x)
 {
-	if(x->previous)
-		cvReleaseMat(&(x->previous));
-	if(x->movement)
-		cvReleaseMat(&(x->movement));
-	if(x->mask)
-		cvReleaseMat(&(x->mask));
-	if(x->eigImage)
-		cvReleaseMat(&(x->eigImage));
-	if(x->tmpImage)
-		cvReleaseMat(&(x->tmpImage));
-	if(x->pyr)
-		cvReleaseMat(&(x->pyr));
-	if(x->prevPyr)
-		cvReleaseMat(&(x->prevPyr));
+	x->field.~FlowField();
+	x->latency.~LatencyHistogram();
 }
-
@@ -0,0 +1,642 @@
+/*
+	cvflow_bench.cpp
+
+	Headless benchmark for the cv.jit.flow tracking core. Feeds synthetic
+	frames to OpticalFlowTracker or FlowField and reports throughput and
+	per-frame latency, so that the hot paths can be profiled with regular
+	tools outside of Max. When built with the headless Jitter stand-in,
+	"-mode jitter" drives the cv_jit_flow/cv_jit_flowfield objects through
+	matrix_calc instead, which includes locking, output resizing and packing.
+	"-checkpyramid 1" compares ImagePyramid's own kernels with
+	cv::buildOpticalFlowPyramid before running ("-checkmask 1" does the same
+	for MotionMask), and "-async 1 -compare 1" checks the threaded tracker
+	against one on the calling thread; "-failframe <n>" makes frame n fail in
+	both and checks that only that frame does. "-stats 1" prints the tracker's
+	per-stage timings for the measured frames and "-histogram 1" the
+	distribution of frame latencies. "-trace <file>" writes the measured
+	frames' stage timelines as Chrome trace JSON.
+
+	Copyright (c) 2008-2017, Jean-Marc Pelletier
+	jmp@jmpelletier.com
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "opencv.hpp"
+#include "OpticalFlowTracker.h"
+#include "AsyncTracker.h"
+#include "FlowField.h"
+#include "MotionMask.h"
+#include "FlowStats.h"
+#include "TraceRecorder.h"
+#include "FrameSource.h"
+
+#ifdef CVFLOW_HEADLESS_JITTER
+#include "jit.common.h"
+
+t_jit_err cv_jit_flow_init(void);
+t_jit_err cv_jit_flowfield_init(void);
+#endif
+
+typedef struct _bench_options
+{
+	const char	*object;
+	int			jitter;
+	int			width;
+	int			height;
+	int			frames;
+	int			warmup;
+	int			detector;
+	int			fastThreshold;
+	int			threads;
+	int			occupancy;
+	int			interval;
+	int			tileCols;
+	int			tileRows;
+	float		threshold;
+	float		distance;
+	int			radius;
+	int			npoints;
+	int			fieldMode;
+	int			dilate;
+	int			seed;
+	int			predict;
+	int			globalMotion;
+	int			fbCheck;
+	float		budget;
+	int			async;
+	int			asyncDetect;
+	int			compare;
+	int			failFrame;
+	int			checkPyramid;
+	int			checkMask;
+	int			stats;
+	int			histogram;
+	const char	*trace;
+	int			telemetry;
+} t_bench_options;
+
+typedef struct _bench_result
+{
+	double		total;		//seconds spent in measured frames
+	double		minLatency;	//milliseconds
+	double		maxLatency;
+	double		features;	//sum of feature counts over measured frames
+	double		vectors;	//sum of output vector counts over measured frames
+	long		allocations;	//buffer allocations during measured frames, -1 if not tracked
+	LatencyHistogram	latency;
+} t_bench_result;
+
+static void usage(){
+	printf("usage: cvflow_bench [options]\n"
+		"  -o flow|flowfield   object to benchmark (default flow)\n"
+		"  -mode core|jitter   call the engine directly or through matrix_calc (default core)\n"
+		"  -w <width>          frame width (default 640)\n"
+		"  -h <height>         frame height (default 480)\n"
+		"  -n <frames>         measured frames (default 300)\n"
+		"  -warmup <frames>    frames processed before measuring (default 10)\n"
+		"  -d eig|fast         feature detector (flow only, default eig)\n"
+		"  -fast <t>           FAST intensity threshold (default 20)\n"
+		"  -tiles <c>x<r>      Shi-Tomasi detection tiles (flow only, default 1x1)\n"
+		"  -occupancy 0|1      only detect away from existing tracks (flow only, default 0)\n"
+		"  -interval <n>       detect every n frames (flow only, default 1)\n"
+		"  -threshold <t>      detector threshold (default 0.01 flow, 0.1 flowfield)\n"
+		"  -distance <d>       minimum feature distance\n"
+		"  -radius <r>         LK window radius (default 7 flow, 5 flowfield)\n"
+		"  -npoints <n>        maximum point count, up to 16384 (flowfield only)\n"
+		"  -fieldmode 0|1      1 keeps tracks from the previous pass (flowfield only, default 0)\n"
+		"  -dilate <n>         grow the motion mask by n pixels, up to 8 (flowfield only, default 0)\n"
+		"  -seed <s>           texture seed (default 1)\n"
+		"  -threads <n>        concurrent LK batches, 0 for automatic (default 0)\n"
+		"  -predict 0|1        start LK from predicted positions (flow only, default 0)\n"
+		"  -globalmotion 0|1   seed LK with the global translation (default 0)\n"
+		"  -budget <ms>        per-frame time budget, 0 for none (flow only, default 0)\n"
+		"  -async 0|1          process on a worker thread, one frame behind (flow only, default 0)\n"
+		"  -asyncdetect 0|1    detect features on a background thread (flow only, default 0)\n"
+		"  -compare 0|1        with -async, wait for each frame and fail if the result differs\n"
+		"                      from a tracker run on the calling thread\n"
+		"  -failframe <n>      with -compare, give frame n an invalid radius and check that\n"
+		"                      both trackers fail that frame only (default -1, none)\n"
+		"  -fbcheck 0|1        forward-backward check (flow only, default 0)\n"
+		"  -checkpyramid 0|1   fail if ImagePyramid differs from cv::buildOpticalFlowPyramid\n"
+		"  -checkmask 0|1      fail if MotionMask differs from cvAbsDiff, cvThreshold and cv::dilate\n"
+		"  -stats 0|1          print per-stage timings (flow only)\n"
+		"  -histogram 0|1      print the frame latency histogram\n"
+		"  -trace <file>       write stage timelines of the measured frames as Chrome trace JSON\n"
+		"  -telemetry 0|1      publish stats to shared memory for cvflow_stat (flow only)\n");
+}
+
+static int parseOptions(int argc, char **argv, t_bench_options *o){
+	int i;
+	o->object = "flow";
+	o->jitter = 0;
+	o->width = 640;
+	o->height = 480;
+	o->frames = 300;
+	o->warmup = 10;
+	o->detector = FEATURE_ALGO_EIGENVALS;
+	o->fastThreshold = 20;
+	o->threads = 0;
+	o->occupancy = 0;
+	o->interval = 1;
+	o->tileCols = 1;
+	o->tileRows = 1;
+	o->threshold = -1.f;
+	o->distance = -1.f;
+	o->radius = -1;
+	o->npoints = 128;
+	o->fieldMode = 0;
+	o->dilate = 0;
+	o->seed = 1;
+	o->predict = 0;
+	o->globalMotion = 0;
+	o->fbCheck = 0;
+	o->budget = 0.f;
+	o->async = 0;
+	o->asyncDetect = 0;
+	o->compare = 0;
+	o->failFrame = -1;
+	o->checkPyramid = 0;
+	o->checkMask = 0;
+	o->stats = 0;
+	o->histogram = 0;
+	o->trace = 0;
+	o->telemetry = 0;
+
+	for(i=1;i<argc;i++){
+		const char *a = argv[i];
+		const char *v = (i + 1 < argc) ? argv[i+1] : 0;
+		if(!strcmp(a, "-help")||!strcmp(a, "--help")){usage(); return 0;}
+		if(!v){fprintf(stderr, "missing value for %s\n", a); return 0;}
+		if(!strcmp(a, "-o"))o->object = v;
+		else if(!strcmp(a, "-mode"))o->jitter = !strcmp(v, "jitter");
+		else if(!strcmp(a, "-w"))o->width = atoi(v);
+		else if(!strcmp(a, "-h"))o->height = atoi(v);
+		else if(!strcmp(a, "-n"))o->frames = atoi(v);
+		else if(!strcmp(a, "-warmup"))o->warmup = atoi(v);
+		else if(!strcmp(a, "-d"))o->detector = strcmp(v, "fast") ? FEATURE_ALGO_EIGENVALS : FEATURE_ALGO_FAST;
+		else if(!strcmp(a, "-tiles")){
+			if(sscanf(v, "%dx%d", &o->tileCols, &o->tileRows) != 2){fprintf(stderr, "-tiles expects <cols>x<rows>\n"); return 0;}
+		}
+		else if(!strcmp(a, "-threads"))o->threads = atoi(v);
+		else if(!strcmp(a, "-occupancy"))o->occupancy = atoi(v);
+		else if(!strcmp(a, "-interval"))o->interval = atoi(v);
+		else if(!strcmp(a, "-fast"))o->fastThreshold = atoi(v);
+		else if(!strcmp(a, "-threshold"))o->threshold = (float)atof(v);
+		else if(!strcmp(a, "-distance"))o->distance = (float)atof(v);
+		else if(!strcmp(a, "-radius"))o->radius = atoi(v);
+		else if(!strcmp(a, "-npoints"))o->npoints = atoi(v);
+		else if(!strcmp(a, "-fieldmode"))o->fieldMode = atoi(v);
+		else if(!strcmp(a, "-dilate"))o->dilate = atoi(v);
+		else if(!strcmp(a, "-seed"))o->seed = atoi(v);
+		else if(!strcmp(a, "-predict"))o->predict = atoi(v);
+		else if(!strcmp(a, "-globalmotion"))o->globalMotion = atoi(v);
+		else if(!strcmp(a, "-budget"))o->budget = (float)atof(v);
+		else if(!strcmp(a, "-async"))o->async = atoi(v);
+		else if(!strcmp(a, "-asyncdetect"))o->asyncDetect = atoi(v);
+		else if(!strcmp(a, "-compare"))o->compare = atoi(v);
+		else if(!strcmp(a, "-failframe"))o->failFrame = atoi(v);
+		else if(!strcmp(a, "-fbcheck"))o->fbCheck = atoi(v);
+		else if(!strcmp(a, "-checkpyramid"))o->checkPyramid = atoi(v);
+		else if(!strcmp(a, "-checkmask"))o->checkMask = atoi(v);
+		else if(!strcmp(a, "-stats"))o->stats = atoi(v);
+		else if(!strcmp(a, "-histogram"))o->histogram = atoi(v);
+		else if(!strcmp(a, "-trace"))o->trace = v;
+		else if(!strcmp(a, "-telemetry"))o->telemetry = atoi(v);
+		else{fprintf(stderr, "unknown option %s\n", a); usage(); return 0;}
+		i++;
+	}
+	if((o->width < 2)||(o->height < 2)||(o->frames < 1)||(o->warmup < 0)){
+		fprintf(stderr, "invalid frame size or count\n");
+		return 0;
+	}
+	//Both make results depend on timing
+	if(o->compare && (!o->async || o->asyncDetect || (o->budget > 0.f))){
+		fprintf(stderr, "-compare needs -async 1, without -asyncdetect or -budget\n");
+		return 0;
+	}
+	if((o->failFrame >= 0) && !o->compare){
+		fprintf(stderr, "-failframe needs -compare 1\n");
+		return 0;
+	}
+	return 1;
+}
+
+static void accumulate(t_bench_result *r, double seconds, unsigned int features, unsigned int vectors){
+	double ms = seconds * 1000.;
+	r->total += seconds;
+	if(ms < r->minLatency)r->minLatency = ms;
+	if(ms > r->maxLatency)r->maxLatency = ms;
+	r->latency.add(ms);
+	r->features += features;
+	r->vectors += vectors;
+}
+
+/*Computes motion masks of a few frame pairs both ways, for several
+  thresholds and dilation radii, and times the two at -dilate.*/
+static int checkMask(const t_bench_options *o){
+	MotionMask fused, reference;
+	FrameSource source(o->width, o->height, o->seed);
+	cv::Mat previous, a(o->height, o->width, CV_8UC1), b(o->height, o->width, CV_8UC1);
+	CvMat ma = a, mb = b;
+	int i, r, t;
+	double fusedTime = 0., referenceTime = 0.;
+
+	CvMat first = source.next();
+	previous = cv::cvarrToMat(&first).clone();
+	for(i=0;i<4;i++){
+		CvMat current = source.next();
+		CvMat prev = previous;
+		for(t=3;t<=20;t+=17){
+			for(r=0;r<=3;r++){
+				if(!fused.compute(&current, &prev, &ma, t, r)){fprintf(stderr, "%s\n", fused.getErrorMess()); return 0;}
+				if(!reference.computeWithOpenCV(&current, &prev, &mb, t, r)){fprintf(stderr, "%s\n", reference.getErrorMess()); return 0;}
+				if(cv::norm(a, b, cv::NORM_INF) != 0.){
+					fprintf(stderr, "FAILED: motion mask differs (threshold %d, radius %d)\n", t, r);
+					return 0;
+				}
+			}
+		}
+		for(int k=0;k<20;k++){
+			int64 start = cv::getTickCount();
+			fused.compute(&current, &prev, &ma, 3, o->dilate);
+			int64 middle = cv::getTickCount();
+			reference.computeWithOpenCV(&current, &prev, &mb, 3, o->dilate);
+			fusedTime += (double)(middle - start);
+			referenceTime += (double)(cv::getTickCount() - middle);
+		}
+		cv::cvarrToMat(&current).copyTo(previous);
+	}
+	printf("motion mask:  matches cvAbsDiff/cvThreshold/cv::dilate, %.3f ms vs %.3f ms\n",
+		fusedTime * 1000. / cv::getTickFrequency() / 80., referenceTime * 1000. / cv::getTickFrequency() / 80.);
+	return 1;
+}
+
+/*Builds pyramids of a few frames both ways and compares every level,
+  including the padding that LK windows can reach.*/
+static int checkPyramid(const t_bench_options *o){
+	ImagePyramid fused, reference;
+	FrameSource source(o->width, o->height, o->seed);
+	int r = o->radius > 0 ? o->radius : 7;
+	CvSize window = cvSize(r * 2 + 1, r * 2 + 1);
+	int i;
+	size_t j;
+
+	for(i=0;i<4;i++){
+		CvMat image = source.next();
+		if(!fused.buildFused(&image, window, 5)){fprintf(stderr, "%s\n", fused.getErrorMess()); return 0;}
+		if(!reference.buildWithOpenCV(&image, window, 5)){fprintf(stderr, "%s\n", reference.getErrorMess()); return 0;}
+		const vector<cv::Mat> &a = fused.getLevels();
+		const vector<cv::Mat> &b = reference.getLevels();
+		if(a.size() != b.size()){
+			fprintf(stderr, "FAILED: pyramid has %d levels, expected %d\n", (int)a.size() / 2, (int)b.size() / 2);
+			return 0;
+		}
+		for(j=0;j<a.size();j++){
+			cv::Mat pa = a[j], pb = b[j];
+			pa.adjustROI(window.height, window.height, window.width, window.width);
+			pb.adjustROI(window.height, window.height, window.width, window.width);
+			if((pa.size() != pb.size())||(pa.type() != pb.type())||(cv::norm(pa, pb, cv::NORM_INF) != 0.)){
+				fprintf(stderr, "FAILED: pyramid %s %d differs\n", j & 1 ? "derivative" : "level", (int)j / 2);
+				return 0;
+			}
+		}
+	}
+	printf("pyramid:      matches cv::buildOpticalFlowPyramid\n");
+	return 1;
+}
+
+static void printStats(const FlowStats &s){
+	int i;
+	for(i=0;i<s.stageCount;i++){
+		printf("  %-18s last %8.3f  mean %8.3f  max %8.3f ms\n", s.names[i], s.last[i], s.getMean(i), s.max[i]);
+	}
+	printf("  %-18s p50  %8.3f  p95  %8.3f  p99  %8.3f ms\n", s.names[s.stageCount-1], s.latency.getPercentile(0.5), s.latency.getPercentile(0.95), s.latency.getPercentile(0.99));
+}
+
+static void printHistogram(const LatencyHistogram &h){
+	int i;
+	unsigned int seen = 0;
+	for(i=0;i<LATENCY_BUCKETS;i++){
+		if(!h.counts[i])continue;
+		seen += h.counts[i];
+		printf("  %9.3f - %9.3f ms  %8u  %6.2f%%\n", LatencyHistogram::getLowerBound(i), LatencyHistogram::getUpperBound(i), h.counts[i], seen * 100. / h.count);
+	}
+}
+
+static int sameResult(const FlowResult &a, const FlowResult &b){
+	if((a.count != b.count)||(a.planes != b.planes))return 0;
+	return !a.count || !memcmp(a.data, b.data, a.count * a.planes * sizeof(float));
+}
+
+static int runTracker(const t_bench_options *o, t_bench_result *r){
+	OpticalFlowTracker tracker, reference;
+	AsyncTracker worker(&tracker);
+	FlowResult result, expected;
+	FlowSettings settings, referenceSettings, failSettings;
+	FrameSource source(o->width, o->height, o->seed);
+	unsigned int warmAllocations = 0;
+	int i;
+
+	settings.threshold = o->threshold >= 0.f ? o->threshold : 0.01f;
+	settings.minDistance = o->distance >= 0.f ? o->distance : 0.01f;
+	settings.radius = o->radius > 0 ? o->radius : 7;
+	settings.detector = o->detector;
+	settings.occupancy = o->occupancy != 0;
+	settings.interval = o->interval > 0 ? o->interval : 1;
+	settings.threads = o->threads;
+	settings.tileCols = o->tileCols;
+	settings.tileRows = o->tileRows;
+	settings.predict = o->predict != 0;
+	settings.globalMotion = o->globalMotion != 0;
+	settings.fbCheck = o->fbCheck != 0;
+	settings.fbThreshold = 1.f;
+	settings.budget = o->budget;
+	settings.asyncDetection = o->asyncDetect != 0;
+	settings.telemetry = o->telemetry != 0;
+	settings.planes = o->fbCheck ? 8 : 7;
+	tracker.setFastThreshold(o->fastThreshold);
+	settings.apply(tracker);
+	//-compare: the same frames through a tracker on this thread
+	referenceSettings = settings;
+	referenceSettings.telemetry = false;
+	reference.setFastThreshold(o->fastThreshold);
+	//-failframe: a window under 3x3 makes the pyramid, and so the frame, fail
+	failSettings = settings;
+	failSettings.radius = 2;
+
+	for(i=0;i<o->warmup+o->frames;i++){
+		CvMat image = source.next();
+		if(!o->async && (i == o->warmup))warmAllocations = tracker.getAllocationCount();
+		if(i == o->warmup)worker.resetStats();
+		if(o->trace && (i == o->warmup))TraceRecorder::get().start();
+		int64 start = cv::getTickCount();
+		if(i == o->failFrame){
+			//Both trackers must fail this frame, and only this one
+			if(!worker.start() || !worker.submit(&image, failSettings)){
+				fprintf(stderr, "frame %d: %s\n", i, worker.getErrorMess());
+				return 0;
+			}
+			worker.wait();
+			failSettings.apply(reference);
+			if(worker.getResult(result) || reference.processFrame(&image)){
+				fprintf(stderr, "FAILED: frame %d should have failed\n", i);
+				return 0;
+			}
+			printf("failframe:    frame %d failed: %s\n", i, worker.getErrorMess());
+			continue;
+		}
+		if(o->async){
+			//Time to hand the frame over and get the previous result back,
+			//or this frame's result with -compare
+			if(!worker.start() || !worker.submit(&image, settings)){
+				fprintf(stderr, "frame %d: %s\n", i, worker.getErrorMess());
+				return 0;
+			}
+			if(o->compare)worker.wait();
+			if(!worker.getResult(result)){
+				fprintf(stderr, "frame %d: %s\n", i, worker.getErrorMess());
+				return 0;
+			}
+		}
+		else if(!tracker.processFrame(&image) || !result.pack(tracker, settings.planes)){
+			fprintf(stderr, "frame %d: %s\n", i, tracker.getErrorMess());
+			return 0;
+		}
+		double seconds = (double)(cv::getTickCount() - start) / cv::getTickFrequency();
+		if(i >= o->warmup)accumulate(r, seconds, o->async ? result.count : tracker.getFeatureCount(), result.count);
+		if(o->compare){
+			referenceSettings.apply(reference);
+			if(!reference.processFrame(&image) || !expected.pack(reference, referenceSettings.planes)){
+				fprintf(stderr, "frame %d: %s\n", i, reference.getErrorMess());
+				return 0;
+			}
+			if(!sameResult(result, expected)){
+				fprintf(stderr, "FAILED: frame %d differs from the synchronous tracker (%u vectors, expected %u)\n", i, result.count, expected.count);
+				return 0;
+			}
+		}
+	}
+	if(o->stats){
+		FlowStats stats;
+		worker.getStats(stats);
+		printf("stages (%u frames):\n", stats.frames);
+		printStats(stats);
+	}
+	if(o->async){
+		worker.stop();
+		printf("async:        %u frames completed, %u dropped\n", worker.getCompletedCount(), worker.getDroppedCount());
+		if(o->compare)printf("compare:      %d frames match the synchronous tracker\n", o->warmup + o->frames - (o->failFrame >= 0 ? 1 : 0));
+	}
+	else r->allocations = (long)(tracker.getAllocationCount() - warmAllocations);
+	//Still published until the tracker goes away
+	if(o->telemetry)printf("telemetry:    %s\n", tracker.getTelemetryName());
+	return 1;
+}
+
+static int runFlowField(const t_bench_options *o, t_bench_result *r){
+	FlowField field;
+	FrameSource source(o->width, o->height, o->seed);
+	unsigned int warmAllocations = 0;
+	int i;
+
+	field.setThreshold(o->threshold >= 0.f ? o->threshold : 0.1f);
+	field.setDistance(o->distance >= 0.f ? o->distance : 5.f);
+	field.setRadius(o->radius > 0 ? o->radius : 5);
+	field.setMaxPoints(o->npoints);
+	field.setMode(o->fieldMode);
+	field.setDilation(o->dilate);
+	field.setThreads(o->threads);
+	field.setGlobalMotion(o->globalMotion != 0);
+
+	for(i=0;i<o->warmup+o->frames;i++){
+		CvMat image = source.next();
+		if(o->trace && (i == o->warmup))TraceRecorder::get().start();
+		if(i == o->warmup)warmAllocations = field.getAllocationCount();
+		int64 start = cv::getTickCount();
+		if(!field.processFrame(&image)){
+			fprintf(stderr, "frame %d: %s\n", i, field.getErrorMess());
+			return 0;
+		}
+		double seconds = (double)(cv::getTickCount() - start) / cv::getTickFrequency();
+		if(i >= o->warmup)accumulate(r, seconds, field.getFeatureCount(), field.getFeatureCount());
+	}
+	r->allocations = (long)(field.getAllocationCount() - warmAllocations);
+	return 1;
+}
+
+#ifdef CVFLOW_HEADLESS_JITTER
+/*Drive a Jitter object the way jit.mop does: one char input matrix and
+  one float32 output matrix, passed to matrix_calc in linked lists.*/
+static int runJitter(const t_bench_options *o, t_bench_result *r){
+	t_jit_matrix_info in_info, out_info;
+	void *obj, *in_matrix, *out_matrix, *inputs, *outputs;
+	t_symbol *classname;
+	uchar *in_bp;
+	int i, y, ok = 1;
+	int flow = !strcmp(o->object, "flow");
+
+	if(flow){
+		cv_jit_flow_init();
+		classname = gensym("cv_jit_flow");
+	}
+	else{
+		cv_jit_flowfield_init();
+		classname = gensym("cv_jit_flowfield");
+	}
+	obj = jit_object_new(classname);
+	if(!obj){fprintf(stderr, "could not create %s\n", classname->s_name); return 0;}
+
+	if(o->threshold >= 0.f)jit_attr_setfloat(obj, gensym("threshold"), o->threshold);
+	if(o->distance >= 0.f)jit_attr_setfloat(obj, gensym("distance"), o->distance);
+	if(o->radius > 0)jit_attr_setlong(obj, gensym("radius"), o->radius);
+	if(!flow){
+		jit_attr_setlong(obj, gensym("npoints"), o->npoints);
+		jit_attr_setlong(obj, gensym("mode"), o->fieldMode);
+		jit_attr_setlong(obj, gensym("dilate"), o->dilate);
+	}
+	jit_attr_setlong(obj, gensym("threads"), o->threads);
+	jit_attr_setlong(obj, gensym("globalmotion"), o->globalMotion);
+	if(flow){
+		t_atom_long tiles[2];
+		tiles[0] = o->tileCols;
+		tiles[1] = o->tileRows;
+		jit_attr_setlong(obj, gensym("detector"), o->detector);
+		jit_attr_setlong(obj, gensym("occupancy"), o->occupancy);
+		jit_attr_setlong(obj, gensym("interval"), o->interval);
+		jit_attr_setlong(obj, gensym("predict"), o->predict);
+		jit_attr_setlong(obj, gensym("fbcheck"), o->fbCheck);
+		jit_attr_setfloat(obj, gensym("budget"), o->budget);
+		jit_attr_setlong(obj, gensym("async"), o->async);
+		jit_attr_setlong(obj, gensym("asyncdetect"), o->asyncDetect);
+		jit_attr_setlong(obj, gensym("telemetry"), o->telemetry);
+		jit_attr_setlong_array(obj, gensym("tiles"), 2, tiles);
+	}
+
+	jit_matrix_info_default(&in_info);
+	in_info.type = _jit_sym_char;
+	in_info.planecount = 1;
+	in_info.dimcount = 2;
+	in_info.dim[0] = o->width;
+	in_info.dim[1] = o->height;
+	in_matrix = jit_object_new(_jit_sym_jit_matrix, &in_info);
+
+	jit_matrix_info_default(&out_info);
+	out_info.type = _jit_sym_float32;
+	out_info.planecount = flow ? 7 : 4;
+	out_info.dimcount = 1;
+	out_info.dim[0] = 1;
+	out_matrix = jit_object_new(_jit_sym_jit_matrix, &out_info);
+
+	inputs = jit_linklist_new();
+	outputs = jit_linklist_new();
+	jit_linklist_append(inputs, in_matrix);
+	jit_linklist_append(outputs, out_matrix);
+
+	jit_object_method(in_matrix, _jit_sym_getinfo, &in_info);
+	jit_object_method(in_matrix, _jit_sym_getdata, &in_bp);
+
+	FrameSource source(o->width, o->height, o->seed);
+	for(i=0;i<o->warmup+o->frames;i++){
+		CvMat image = source.next();
+		for(y=0;y<o->height;y++)memcpy(in_bp + y * in_info.dimstride[1], image.data.ptr + y * image.step, o->width);
+
+		if(flow && (i == o->warmup))jit_object_method(obj, gensym("resetstats"));
+		if(o->trace && (i == o->warmup))jit_object_method(obj, gensym("tracestart"));
+		int64 start = cv::getTickCount();
+		t_jit_err err = (t_jit_err)(t_ptr_int)jit_object_method(obj, _jit_sym_matrix_calc, inputs, outputs);
+		double seconds = (double)(cv::getTickCount() - start) / cv::getTickFrequency();
+		if(err != JIT_ERR_NONE){
+			fprintf(stderr, "frame %d: matrix_calc returned %ld\n", i, (long)err);
+			ok = 0;
+			break;
+		}
+		jit_object_method(out_matrix, _jit_sym_getinfo, &out_info);
+		if(i >= o->warmup)accumulate(r, seconds, (unsigned int)out_info.dim[0], (unsigned int)out_info.dim[0]);
+	}
+
+	if(ok && o->trace){
+		jit_object_method(obj, gensym("tracestop"));
+		jit_object_method(obj, gensym("tracewrite"), gensym((char *)o->trace));
+	}
+	if(ok && flow && o->stats){
+		FlowStats tracker, wrapper;
+		jit_object_method(obj, gensym("getstats"), &tracker, &wrapper);
+		printf("stages (%u frames):\n", tracker.frames);
+		printStats(tracker);
+		printStats(wrapper);
+	}
+
+	jit_object_free(obj);
+	jit_object_free(inputs);
+	jit_object_free(outputs);
+	jit_object_free(in_matrix);
+	jit_object_free(out_matrix);
+	return ok;
+}
+#endif
+
+int main(int argc, char **argv){
+	t_bench_options o;
+	t_bench_result r;
+	int ok;
+
+	if(!parseOptions(argc, argv, &o))return 1;
+	if(o.checkPyramid && !checkPyramid(&o))return 1;
+	if(o.checkMask && !checkMask(&o))return 1;
+
+	r.total = 0.;
+	r.minLatency = 1e30;
+	r.maxLatency = 0.;
+	r.features = 0.;
+	r.vectors = 0.;
+	r.allocations = -1;
+	r.latency.reset();
+
+	if(o.jitter){
+#ifdef CVFLOW_HEADLESS_JITTER
+		if(strcmp(o.object, "flow")&&strcmp(o.object, "flowfield")){fprintf(stderr, "unknown object %s\n", o.object); return 1;}
+		ok = runJitter(&o, &r);
+#else
+		fprintf(stderr, "cvflow_bench was built without the headless Jitter layer\n");
+		return 1;
+#endif
+	}
+	else if(!strcmp(o.object, "flow"))ok = runTracker(&o, &r);
+	else if(!strcmp(o.object, "flowfield"))ok = runFlowField(&o, &r);
+	else{fprintf(stderr, "unknown object %s\n", o.object); return 1;}
+	if(!ok)return 1;
+	if(o.trace && !o.jitter){
+		TraceRecorder::get().stop();
+		if(!TraceRecorder::get().write(o.trace)){fprintf(stderr, "%s\n", TraceRecorder::get().getErrorMess()); return 1;}
+	}
+
+	printf("object:       %s (%s)\n", o.object, o.jitter ? "matrix_calc" : "core");
+	printf("frame size:   %dx%d\n", o.width, o.height);
+	printf("frames:       %d (+%d warm-up)\n", o.frames, o.warmup);
+	printf("fps:          %.1f\n", (double)o.frames / r.total);
+	printf("latency (ms): mean %.3f  min %.3f  max %.3f\n", r.total * 1000. / o.frames, r.minLatency, r.maxLatency);
+	printf("percentiles:  p50 %.3f  p95 %.3f  p99 %.3f\n", r.latency.getPercentile(0.5), r.latency.getPercentile(0.95), r.latency.getPercentile(0.99));
+	if(o.histogram)printHistogram(r.latency);
+	if(o.trace)printf("trace:        %s\n", o.trace);
+	printf("features:     %.1f per frame\n", r.features / o.frames);
+	printf("vectors:      %.1f per frame\n", r.vectors / o.frames);
+	if(r.allocations >= 0)printf("allocations:  %ld after warm-up\n", r.allocations);
+	return 0;
+}
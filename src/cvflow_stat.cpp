@@ -0,0 +1,125 @@
+/*
+	cvflow_stat.cpp
+
+	Shows the stats that cv.jit.flow instances publish to shared memory
+	when their "telemetry" attribute is on: frame rate, latency percentiles,
+	feature and vector counts and per-stage timings. Without arguments it
+	lists every /cvflow.* segment (Linux); segments can also be named on the
+	command line. "-watch <seconds>" refreshes until interrupted.
+
+	Copyright (c) 2008-2017, Jean-Marc Pelletier
+	jmp@jmpelletier.com
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+#include "Telemetry.h"
+
+#ifndef _WIN32
+#include <dirent.h>
+#endif
+
+static void usage(){
+	printf("usage: cvflow_stat [-watch <seconds>] [-stages 0|1] [segment...]\n"
+		"  segment             /cvflow.<pid>.<instance>, all segments by default (Linux)\n"
+		"  -watch <seconds>    refresh every n seconds until interrupted\n"
+		"  -stages 0|1         show per-stage timings (default 1)\n");
+}
+
+//Segments in /dev/shm, where Linux keeps POSIX shared memory
+static void findSegments(std::vector<std::string> &names){
+#ifndef _WIN32
+	DIR *dir = opendir("/dev/shm");
+	struct dirent *e;
+	if(!dir)return;
+	while((e = readdir(dir)) != 0){
+		if(!strncmp(e->d_name, TELEMETRY_PREFIX, strlen(TELEMETRY_PREFIX)))names.push_back(std::string("/") + e->d_name);
+	}
+	closedir(dir);
+	std::sort(names.begin(), names.end());
+#endif
+}
+
+static int64_t now(){
+	return (int64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static int show(const char *name, int stages){
+	TelemetryReader reader;
+	TelemetryData d;
+	int i;
+
+	if(!reader.open(name) || !reader.read(d)){
+		fprintf(stderr, "%s: %s\n", name, reader.getErrorMess());
+		return 0;
+	}
+	printf("%s  pid %u  instance %d  updated %.1f s ago\n", name, reader.getPid(), reader.getInstance(), (double)(now() - d.updated) * 0.000001);
+	printf("  fps %.1f  frames %u  features %u  vectors %u  good %u\n", d.fps, d.frames, d.features, d.vectors, d.goodVectors);
+	printf("  latency (ms): p50 %.3f  p95 %.3f  p99 %.3f\n", d.p50, d.p95, d.p99);
+	if(stages){
+		int n = d.stageCount < FLOW_STATS_MAX_STAGES ? d.stageCount : FLOW_STATS_MAX_STAGES;
+		for(i=0;i<n;i++){
+			d.stages[i].name[TELEMETRY_NAME_LENGTH - 1] = 0;
+			printf("  %-18s last %8.3f  mean %8.3f  max %8.3f ms\n", d.stages[i].name, d.stages[i].last, d.stages[i].mean, d.stages[i].max);
+		}
+	}
+	return 1;
+}
+
+int main(int argc, char **argv){
+	std::vector<std::string> names;
+	double watch = 0.;
+	int stages = 1;
+	int i, ok;
+
+	for(i=1;i<argc;i++){
+		const char *a = argv[i];
+		if(!strcmp(a, "-help")||!strcmp(a, "--help")){usage(); return 0;}
+		if(a[0] == '-'){
+			if(i + 1 >= argc){fprintf(stderr, "missing value for %s\n", a); return 1;}
+			if(!strcmp(a, "-watch"))watch = atof(argv[++i]);
+			else if(!strcmp(a, "-stages"))stages = atoi(argv[++i]);
+			else{fprintf(stderr, "unknown option %s\n", a); usage(); return 1;}
+		}
+		else names.push_back(a);
+	}
+
+	bool all = names.empty();
+	do{
+		if(all){
+			names.clear();
+			findSegments(names);
+		}
+		if(watch > 0.)printf("\033[H\033[J");	//Clear the terminal
+		if(names.empty())printf("no cv.jit.flow telemetry found\n");
+		ok = 1;
+		for(i=0;i<(int)names.size();i++){
+			if(!show(names[i].c_str(), stages))ok = 0;
+		}
+		fflush(stdout);
+		if(watch > 0.)std::this_thread::sleep_for(std::chrono::milliseconds((long long)(watch * 1000.)));
+	}while(watch > 0.);
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,196 @@
+/*
+	jit.common.h (headless stand-in)
+
+	Minimal replacement for the subset of the Max/Jitter SDK used by
+	cv.jit.flow.cpp and cv.jit.flowfield.cpp, so that the Jitter objects
+	can be driven without Max, e.g. from cvflow_bench. Only what these
+	objects need is provided: symbols, class registration, offset
+	attributes, matrices with lock/getinfo/setinfo/getdata and the
+	linked list used to pass matrices to matrix_calc.
+
+	This header is only meant to be on the include path of headless
+	builds; Max builds use the real SDK headers from cycling74/.
+*/
+
+#ifndef _JIT_COMMON_HEADLESS_H_
+#define _JIT_COMMON_HEADLESS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define JIT_HEADLESS 1
+
+#ifndef TRUE
+#define TRUE 1
+#endif
+#ifndef FALSE
+#define FALSE 0
+#endif
+
+typedef intptr_t t_ptr_int;
+typedef t_ptr_int t_atom_long;
+typedef double t_atom_float;
+typedef long t_jit_err;
+typedef unsigned char uchar;
+typedef void *(*method)(void *, ...);
+
+typedef struct _symbol
+{
+	char			*s_name;
+	void			*s_thing;
+} t_symbol;
+
+struct _jit_headless_class;
+
+/*Every object created through this layer starts with a t_object header,
+  which is how jit_object_method finds out what it is talking to.*/
+typedef struct _object
+{
+	struct _jit_headless_class	*o_class;
+	long						o_kind;
+} t_object;
+
+typedef t_object t_jit_object;
+
+/*Atoms, as custom attribute setters receive their values*/
+union word
+{
+	t_atom_long		w_long;
+	t_atom_float	w_float;
+	t_symbol		*w_sym;
+};
+
+typedef struct atom
+{
+	short			a_type;
+	union word		a_w;
+} t_atom;
+
+#define calcoffset(x,y) ((t_ptr_int)(&(((x *)0L)->y)))
+
+/*Argument types*/
+#define A_NOTHING	0
+#define A_LONG		1
+#define A_FLOAT		2
+#define A_SYM		3
+#define A_GIMME		8
+#define A_CANT		9
+
+/*Errors*/
+#define JIT_ERR_NONE				0
+#define JIT_ERR_GENERIC				'EROR'
+#define JIT_ERR_INVALID_OBJECT		'INOB'
+#define JIT_ERR_OBJECT_BUSY			'OBSY'
+#define JIT_ERR_OUT_OF_MEM			'OMEM'
+#define JIT_ERR_INVALID_PTR			'INVP'
+#define JIT_ERR_DUPLICATE			'DUPL'
+#define JIT_ERR_OUT_OF_BOUNDS		'OBND'
+#define JIT_ERR_INVALID_INPUT		'INVI'
+#define JIT_ERR_INVALID_OUTPUT		'INVO'
+#define JIT_ERR_MISMATCH_TYPE		'MSTP'
+#define JIT_ERR_MISMATCH_PLANE		'MSPL'
+#define JIT_ERR_MISMATCH_DIM		'MSDM'
+#define JIT_ERR_MATRIX_UNKNOWN		'MXUN'
+
+/*Attribute flags*/
+#define JIT_ATTR_GET_OPAQUE			0x00000001
+#define JIT_ATTR_SET_OPAQUE			0x00000002
+#define JIT_ATTR_GET_OPAQUE_USER	0x00000100
+#define JIT_ATTR_SET_OPAQUE_USER	0x00000200
+#define JIT_ATTR_GET_DEFER			0x00010000
+#define JIT_ATTR_GET_USURP			0x00020000
+#define JIT_ATTR_GET_DEFER_LOW		0x00040000
+#define JIT_ATTR_GET_USURP_LOW		0x00080000
+#define JIT_ATTR_SET_DEFER			0x01000000
+#define JIT_ATTR_SET_USURP			0x02000000
+#define JIT_ATTR_SET_DEFER_LOW		0x04000000
+#define JIT_ATTR_SET_USURP_LOW		0x08000000
+
+#define JIT_MATRIX_MAX_DIMCOUNT		32
+#define JIT_MATRIX_MAX_PLANECOUNT	32
+
+typedef struct _jit_matrix_info
+{
+	long		size;
+	t_symbol	*type;
+	long		flags;
+	long		dimcount;
+	long		dim[JIT_MATRIX_MAX_DIMCOUNT];
+	long		dimstride[JIT_MATRIX_MAX_DIMCOUNT];
+	long		planecount;
+} t_jit_matrix_info;
+
+/*Common symbols*/
+extern t_symbol *_jit_sym_char;
+extern t_symbol *_jit_sym_long;
+extern t_symbol *_jit_sym_float32;
+extern t_symbol *_jit_sym_float64;
+extern t_symbol *_jit_sym_symbol;
+extern t_symbol *_jit_sym_jit_mop;
+extern t_symbol *_jit_sym_jit_matrix;
+extern t_symbol *_jit_sym_jit_attr_offset;
+extern t_symbol *_jit_sym_jit_attr_offset_array;
+extern t_symbol *_jit_sym_getoutput;
+extern t_symbol *_jit_sym_getinput;
+extern t_symbol *_jit_sym_getindex;
+extern t_symbol *_jit_sym_getsize;
+extern t_symbol *_jit_sym_lock;
+extern t_symbol *_jit_sym_getinfo;
+extern t_symbol *_jit_sym_setinfo;
+extern t_symbol *_jit_sym_getdata;
+extern t_symbol *_jit_sym_matrix_calc;
+extern t_symbol *_jit_sym_minplanecount;
+extern t_symbol *_jit_sym_maxplanecount;
+extern t_symbol *_jit_sym_mindim;
+extern t_symbol *_jit_sym_maxdim;
+extern t_symbol *_jit_sym_types;
+
+t_symbol *gensym(const char *s);
+void error(const char *fmt, ...);
+void post(const char *fmt, ...);
+
+/*Classes and objects*/
+void *jit_class_new(const char *name, method mnew, method mfree, long size, ...);
+t_jit_err jit_class_addmethod(void *c, method m, const char *name, ...);
+t_jit_err jit_class_addattr(void *c, t_jit_object *attr);
+t_jit_err jit_class_addadornment(void *c, t_jit_object *o);
+t_jit_err jit_class_register(void *c);
+void *jit_class_findbyname(t_symbol *classname);
+
+void *jit_object_alloc(void *c);
+void *jit_object_new(t_symbol *classname, ...);
+t_jit_err jit_object_free(void *x);
+void *jit_object_method(void *x, t_symbol *s, ...);
+
+/*Attributes*/
+t_jit_err jit_attr_addfilterset_clip(t_jit_object *x, double min, double max, long usemin, long usemax);
+t_jit_err jit_attr_setlong(void *x, t_symbol *s, t_atom_long c);
+t_jit_err jit_attr_setfloat(void *x, t_symbol *s, t_atom_float c);
+t_jit_err jit_attr_setsym(void *x, t_symbol *s, t_symbol *c);
+t_atom_long jit_attr_getlong(void *x, t_symbol *s);
+t_atom_float jit_attr_getfloat(void *x, t_symbol *s);
+t_jit_err jit_attr_setlong_array(void *x, t_symbol *s, long count, t_atom_long *vals);
+long jit_attr_getlong_array(void *x, t_symbol *s, long max, t_atom_long *vals);
+t_atom_long jit_atom_getlong(t_atom *a);
+
+/*Matrix operators*/
+t_jit_err jit_mop_single_type(void *x, t_symbol *s);
+t_jit_err jit_mop_single_planecount(void *x, long c);
+t_jit_err jit_mop_output_nolink(void *x, long index);
+
+/*Matrices*/
+t_jit_err jit_matrix_info_default(t_jit_matrix_info *info);
+
+/*Linked lists, used as the inputs/outputs arguments of matrix_calc*/
+void *jit_linklist_new(void);
+t_atom_long jit_linklist_append(void *x, void *o);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,590 @@
+/*
+	jit.headless.cpp
+
+	Implementation of the headless jit.common.h stand-in. Objects are plain
+	heap blocks starting with a t_object header; classes, methods and
+	attributes are kept in simple tables. Matrices behave like Jitter
+	matrices as far as matrix_calc can tell: locking, getinfo/setinfo with
+	reallocation on resize, and 16-byte aligned rows.
+*/
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "jit.common.h"
+
+using namespace std;
+
+enum{
+	OBJECT_INSTANCE = 1,
+	OBJECT_MATRIX,
+	OBJECT_LINKLIST,
+	OBJECT_MOP,
+	OBJECT_MOP_IO,
+	OBJECT_ATTR
+};
+
+typedef struct _jit_headless_method
+{
+	t_symbol	*name;
+	method		m;
+	long		type;
+} t_jit_headless_method;
+
+typedef struct _jit_headless_attr
+{
+	t_object	ob;
+	t_symbol	*name;
+	t_symbol	*type;
+	long		flags;
+	method		mget;
+	method		mset;
+	long		size;		//element count, 1 for scalar attributes
+	t_ptr_int	countOffset;
+	t_ptr_int	offset;
+	char		clip;
+	double		min;
+	double		max;
+	long		usemin;
+	long		usemax;
+} t_jit_headless_attr;
+
+typedef struct _jit_headless_class
+{
+	t_symbol						*name;
+	method							mnew;
+	method							mfree;
+	long							size;
+	vector<t_jit_headless_method>	methods;
+	vector<t_jit_headless_attr*>	attrs;
+} t_jit_headless_class;
+
+typedef struct _jit_headless_matrix
+{
+	t_object			ob;
+	t_jit_matrix_info	info;
+	long				lock;
+	char				*data;
+	size_t				capacity;
+} t_jit_headless_matrix;
+
+typedef struct _jit_headless_linklist
+{
+	t_object			ob;
+	vector<void*>		items;
+} t_jit_headless_linklist;
+
+typedef struct _jit_headless_mop
+{
+	t_object				ob;
+	t_object				input;
+	t_object				output;
+} t_jit_headless_mop;
+
+
+/*******************************Symbols*********************************/
+
+static map<string, t_symbol*>& symbolTable(){
+	static map<string, t_symbol*> table;
+	return table;
+}
+
+t_symbol *gensym(const char *s){
+	map<string, t_symbol*> &table = symbolTable();
+	map<string, t_symbol*>::iterator it = table.find(s);
+	if(it != table.end())return it->second;
+	t_symbol *sym = new t_symbol;
+	sym->s_name = strdup(s);
+	sym->s_thing = 0;
+	table[s] = sym;
+	return sym;
+}
+
+t_symbol *_jit_sym_char = gensym("char");
+t_symbol *_jit_sym_long = gensym("long");
+t_symbol *_jit_sym_float32 = gensym("float32");
+t_symbol *_jit_sym_float64 = gensym("float64");
+t_symbol *_jit_sym_symbol = gensym("symbol");
+t_symbol *_jit_sym_jit_mop = gensym("jit_mop");
+t_symbol *_jit_sym_jit_matrix = gensym("jit_matrix");
+t_symbol *_jit_sym_jit_attr_offset = gensym("jit_attr_offset");
+t_symbol *_jit_sym_jit_attr_offset_array = gensym("jit_attr_offset_array");
+t_symbol *_jit_sym_getoutput = gensym("getoutput");
+t_symbol *_jit_sym_getinput = gensym("getinput");
+t_symbol *_jit_sym_getindex = gensym("getindex");
+t_symbol *_jit_sym_getsize = gensym("getsize");
+t_symbol *_jit_sym_lock = gensym("lock");
+t_symbol *_jit_sym_getinfo = gensym("getinfo");
+t_symbol *_jit_sym_setinfo = gensym("setinfo");
+t_symbol *_jit_sym_getdata = gensym("getdata");
+t_symbol *_jit_sym_matrix_calc = gensym("matrix_calc");
+t_symbol *_jit_sym_minplanecount = gensym("minplanecount");
+t_symbol *_jit_sym_maxplanecount = gensym("maxplanecount");
+t_symbol *_jit_sym_mindim = gensym("mindim");
+t_symbol *_jit_sym_maxdim = gensym("maxdim");
+t_symbol *_jit_sym_types = gensym("types");
+
+void error(const char *fmt, ...){
+	va_list ap;
+	va_start(ap, fmt);
+	fprintf(stderr, "error: ");
+	vfprintf(stderr, fmt, ap);
+	fprintf(stderr, "\n");
+	va_end(ap);
+}
+
+void post(const char *fmt, ...){
+	va_list ap;
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	printf("\n");
+	va_end(ap);
+}
+
+
+/*******************************Classes*********************************/
+
+static map<t_symbol*, t_jit_headless_class*>& classTable(){
+	static map<t_symbol*, t_jit_headless_class*> table;
+	return table;
+}
+
+void *jit_class_new(const char *name, method mnew, method mfree, long size, ...){
+	t_jit_headless_class *c = new t_jit_headless_class;
+	c->name = gensym(name);
+	c->mnew = mnew;
+	c->mfree = mfree;
+	c->size = size;
+	return c;
+}
+
+t_jit_err jit_class_addmethod(void *c, method m, const char *name, ...){
+	va_list ap;
+	t_jit_headless_method hm;
+	if(!c)return JIT_ERR_INVALID_PTR;
+	va_start(ap, name);
+	hm.type = va_arg(ap, int);
+	va_end(ap);
+	hm.name = gensym(name);
+	hm.m = m;
+	((t_jit_headless_class*)c)->methods.push_back(hm);
+	return JIT_ERR_NONE;
+}
+
+t_jit_err jit_class_addattr(void *c, t_jit_object *attr){
+	if((!c)||(!attr)||(attr->o_kind != OBJECT_ATTR))return JIT_ERR_INVALID_PTR;
+	((t_jit_headless_class*)c)->attrs.push_back((t_jit_headless_attr*)attr);
+	return JIT_ERR_NONE;
+}
+
+t_jit_err jit_class_addadornment(void *c, t_jit_object *o){
+	return c ? JIT_ERR_NONE : JIT_ERR_INVALID_PTR;
+}
+
+t_jit_err jit_class_register(void *c){
+	if(!c)return JIT_ERR_INVALID_PTR;
+	classTable()[((t_jit_headless_class*)c)->name] = (t_jit_headless_class*)c;
+	return JIT_ERR_NONE;
+}
+
+void *jit_class_findbyname(t_symbol *classname){
+	map<t_symbol*, t_jit_headless_class*>::iterator it = classTable().find(classname);
+	return it == classTable().end() ? 0 : it->second;
+}
+
+static t_jit_headless_method *findMethod(t_jit_headless_class *c, t_symbol *s){
+	unsigned int i;
+	for(i=0;i<c->methods.size();i++)if(c->methods[i].name == s)return &c->methods[i];
+	return 0;
+}
+
+static t_jit_headless_attr *findAttr(void *x, t_symbol *s){
+	t_object *o = (t_object*)x;
+	unsigned int i;
+	if((!o)||(o->o_kind != OBJECT_INSTANCE))return 0;
+	for(i=0;i<o->o_class->attrs.size();i++)if(o->o_class->attrs[i]->name == s)return o->o_class->attrs[i];
+	return 0;
+}
+
+
+/*******************************Matrices*********************************/
+
+static size_t typeSize(t_symbol *type){
+	if(type == _jit_sym_char)return 1;
+	if(type == _jit_sym_long)return sizeof(long);
+	if(type == _jit_sym_float32)return 4;
+	if(type == _jit_sym_float64)return 8;
+	return 1;
+}
+
+t_jit_err jit_matrix_info_default(t_jit_matrix_info *info){
+	if(!info)return JIT_ERR_INVALID_PTR;
+	memset(info, 0, sizeof(t_jit_matrix_info));
+	info->size = sizeof(t_jit_matrix_info);
+	info->type = _jit_sym_char;
+	info->dimcount = 2;
+	info->dim[0] = 1;
+	info->dim[1] = 1;
+	info->planecount = 4;
+	return JIT_ERR_NONE;
+}
+
+static t_jit_err matrixSetInfo(t_jit_headless_matrix *m, t_jit_matrix_info *info){
+	t_jit_matrix_info *mi = &m->info;
+	size_t bytes;
+	long i;
+
+	if((!info)||(info->dimcount < 1)||(info->dimcount > JIT_MATRIX_MAX_DIMCOUNT))return JIT_ERR_INVALID_INPUT;
+	if((info->planecount < 1)||(info->planecount > JIT_MATRIX_MAX_PLANECOUNT))return JIT_ERR_MISMATCH_PLANE;
+
+	mi->size = sizeof(t_jit_matrix_info);
+	mi->type = info->type ? info->type : _jit_sym_char;
+	mi->flags = info->flags;
+	mi->dimcount = info->dimcount;
+	mi->planecount = info->planecount;
+
+	//Like Jitter, dimensions are at least 1 and rows are 16-byte aligned.
+	mi->dimstride[0] = (long)typeSize(mi->type) * mi->planecount;
+	for(i=0;i<mi->dimcount;i++){
+		mi->dim[i] = info->dim[i] < 1 ? 1 : info->dim[i];
+		if(i == 1)mi->dimstride[1] = ((mi->dim[0] * mi->dimstride[0]) + 15) & ~15L;
+		else if(i > 1)mi->dimstride[i] = mi->dim[i-1] * mi->dimstride[i-1];
+	}
+	bytes = (mi->dimcount > 1 ? mi->dimstride[mi->dimcount-1] : mi->dimstride[0]) * mi->dim[mi->dimcount-1];
+	if(bytes > m->capacity){
+		free(m->data);
+		m->data = (char*)calloc(bytes, 1);
+		if(!m->data){m->capacity = 0; return JIT_ERR_OUT_OF_MEM;}
+		m->capacity = bytes;
+	}
+	return JIT_ERR_NONE;
+}
+
+static void *matrixNew(t_jit_matrix_info *info){
+	t_jit_headless_matrix *m = new t_jit_headless_matrix;
+	t_jit_matrix_info def;
+	m->ob.o_class = 0;
+	m->ob.o_kind = OBJECT_MATRIX;
+	m->lock = 0;
+	m->data = 0;
+	m->capacity = 0;
+	if(!info){jit_matrix_info_default(&def); info = &def;}
+	if(matrixSetInfo(m, info) != JIT_ERR_NONE){
+		free(m->data);
+		delete m;
+		return 0;
+	}
+	return m;
+}
+
+static void *matrixMethod(t_jit_headless_matrix *m, t_symbol *s, va_list ap){
+	if(s == _jit_sym_lock){
+		long previous = m->lock;
+		m->lock = va_arg(ap, int);
+		return (void*)(t_ptr_int)previous;
+	}
+	if(s == _jit_sym_getinfo){
+		t_jit_matrix_info *info = va_arg(ap, t_jit_matrix_info*);
+		if(info)*info = m->info;
+		return 0;
+	}
+	if(s == _jit_sym_setinfo){
+		return (void*)(t_ptr_int)matrixSetInfo(m, va_arg(ap, t_jit_matrix_info*));
+	}
+	if(s == _jit_sym_getdata){
+		void **data = va_arg(ap, void**);
+		if(data)*data = m->data;
+		return 0;
+	}
+	return 0;
+}
+
+
+/*******************************Linked lists*********************************/
+
+void *jit_linklist_new(void){
+	t_jit_headless_linklist *l = new t_jit_headless_linklist;
+	l->ob.o_class = 0;
+	l->ob.o_kind = OBJECT_LINKLIST;
+	return l;
+}
+
+t_atom_long jit_linklist_append(void *x, void *o){
+	t_jit_headless_linklist *l = (t_jit_headless_linklist*)x;
+	if((!l)||(l->ob.o_kind != OBJECT_LINKLIST))return -1;
+	l->items.push_back(o);
+	return (t_atom_long)l->items.size();
+}
+
+static void *linklistMethod(t_jit_headless_linklist *l, t_symbol *s, va_list ap){
+	if(s == _jit_sym_getindex){
+		long index = va_arg(ap, int);
+		return ((index >= 0)&&(index < (long)l->items.size())) ? l->items[index] : 0;
+	}
+	if(s == _jit_sym_getsize)return (void*)(t_ptr_int)l->items.size();
+	return 0;
+}
+
+
+/*******************************Objects*********************************/
+
+void *jit_object_alloc(void *c){
+	t_jit_headless_class *hc = (t_jit_headless_class*)c;
+	t_object *o;
+	if((!hc)||(hc->size < (long)sizeof(t_object)))return 0;
+	o = (t_object*)calloc(1, hc->size);
+	if(!o)return 0;
+	o->o_class = hc;
+	o->o_kind = OBJECT_INSTANCE;
+	return o;
+}
+
+void *jit_object_new(t_symbol *classname, ...){
+	va_list ap;
+	void *o = 0;
+
+	va_start(ap, classname);
+	if(classname == _jit_sym_jit_matrix){
+		o = matrixNew(va_arg(ap, t_jit_matrix_info*));
+	}
+	else if(classname == _jit_sym_jit_mop){
+		t_jit_headless_mop *mop = new t_jit_headless_mop;
+		mop->ob.o_class = 0;
+		mop->ob.o_kind = OBJECT_MOP;
+		mop->input.o_class = 0;
+		mop->input.o_kind = OBJECT_MOP_IO;
+		mop->output.o_class = 0;
+		mop->output.o_kind = OBJECT_MOP_IO;
+		o = mop;
+	}
+	else if((classname == _jit_sym_jit_attr_offset)||(classname == _jit_sym_jit_attr_offset_array)){
+		t_jit_headless_attr *attr = new t_jit_headless_attr;
+		attr->ob.o_class = 0;
+		attr->ob.o_kind = OBJECT_ATTR;
+		attr->name = gensym(va_arg(ap, char*));
+		attr->type = va_arg(ap, t_symbol*);
+		if(classname == _jit_sym_jit_attr_offset_array)attr->size = va_arg(ap, long);
+		else attr->size = 1;
+		attr->flags = va_arg(ap, long);
+		attr->mget = va_arg(ap, method);
+		attr->mset = va_arg(ap, method);
+		if(classname == _jit_sym_jit_attr_offset_array)attr->countOffset = va_arg(ap, t_ptr_int);
+		else attr->countOffset = 0;
+		attr->offset = va_arg(ap, t_ptr_int);
+		attr->clip = 0;
+		attr->min = attr->max = 0.;
+		attr->usemin = attr->usemax = 0;
+		o = attr;
+	}
+	else{
+		t_jit_headless_class *c = (t_jit_headless_class*)jit_class_findbyname(classname);
+		if(c && c->mnew)o = (c->mnew)(0);
+	}
+	va_end(ap);
+	return o;
+}
+
+t_jit_err jit_object_free(void *x){
+	t_object *o = (t_object*)x;
+	if(!o)return JIT_ERR_INVALID_PTR;
+	switch(o->o_kind){
+		case OBJECT_INSTANCE:
+			if(o->o_class->mfree)(o->o_class->mfree)(o);
+			free(o);
+			break;
+		case OBJECT_MATRIX:
+			free(((t_jit_headless_matrix*)o)->data);
+			delete (t_jit_headless_matrix*)o;
+			break;
+		case OBJECT_LINKLIST:
+			delete (t_jit_headless_linklist*)o;
+			break;
+		case OBJECT_MOP:
+			delete (t_jit_headless_mop*)o;
+			break;
+		case OBJECT_ATTR:
+			delete (t_jit_headless_attr*)o;
+			break;
+		default:
+			return JIT_ERR_INVALID_OBJECT;
+	}
+	return JIT_ERR_NONE;
+}
+
+void *jit_object_method(void *x, t_symbol *s, ...){
+	t_object *o = (t_object*)x;
+	va_list ap;
+	void *result = 0;
+
+	if((!o)||(!s))return 0;
+	va_start(ap, s);
+	switch(o->o_kind){
+		case OBJECT_MATRIX:
+			result = matrixMethod((t_jit_headless_matrix*)o, s, ap);
+			break;
+		case OBJECT_LINKLIST:
+			result = linklistMethod((t_jit_headless_linklist*)o, s, ap);
+			break;
+		case OBJECT_MOP:
+			if(s == _jit_sym_getoutput)result = &((t_jit_headless_mop*)o)->output;
+			else if(s == _jit_sym_getinput)result = &((t_jit_headless_mop*)o)->input;
+			break;
+		case OBJECT_INSTANCE:{
+			t_jit_headless_method *m = findMethod(o->o_class, s);
+			if(!m)break;
+			//A_CANT methods get their arguments forwarded as pointers
+			if(m->type == A_CANT){
+				void *a = va_arg(ap, void*);
+				void *b = va_arg(ap, void*);
+				result = (m->m)(o, a, b);
+			}
+			//A_SYM methods get one symbol
+			else if(m->type == A_SYM)result = (m->m)(o, va_arg(ap, t_symbol*));
+			else result = (m->m)(o);
+			break;
+		}
+		default:
+			break;
+	}
+	va_end(ap);
+	return result;
+}
+
+
+/*******************************Attributes*********************************/
+
+t_jit_err jit_attr_addfilterset_clip(t_jit_object *x, double min, double max, long usemin, long usemax){
+	t_jit_headless_attr *attr = (t_jit_headless_attr*)x;
+	if((!attr)||(attr->ob.o_kind != OBJECT_ATTR))return JIT_ERR_INVALID_PTR;
+	attr->clip = 1;
+	attr->min = min;
+	attr->max = max;
+	attr->usemin = usemin;
+	attr->usemax = usemax;
+	return JIT_ERR_NONE;
+}
+
+static double clipValue(t_jit_headless_attr *attr, double v){
+	if(!attr->clip)return v;
+	if(attr->usemin && (v < attr->min))v = attr->min;
+	if(attr->usemax && (v > attr->max))v = attr->max;
+	return v;
+}
+
+static t_jit_err setNumber(void *x, t_symbol *s, double v){
+	t_jit_headless_attr *attr = findAttr(x, s);
+	char *p;
+	if(!attr)return JIT_ERR_INVALID_INPUT;
+	p = (char*)x + attr->offset;
+	v = clipValue(attr, v);
+	//A custom setter stores the value itself
+	if(attr->mset){
+		t_atom a;
+		if((attr->type == _jit_sym_float32)||(attr->type == _jit_sym_float64)){
+			a.a_type = A_FLOAT;
+			a.a_w.w_float = v;
+		}
+		else{
+			a.a_type = A_LONG;
+			a.a_w.w_long = (t_atom_long)v;
+		}
+		(attr->mset)(x, attr, 1L, &a);
+		return JIT_ERR_NONE;
+	}
+	if(attr->type == _jit_sym_char)*(uchar*)p = (uchar)v;
+	else if(attr->type == _jit_sym_long)*(long*)p = (long)v;
+	else if(attr->type == _jit_sym_float32)*(float*)p = (float)v;
+	else if(attr->type == _jit_sym_float64)*(double*)p = v;
+	else return JIT_ERR_MISMATCH_TYPE;
+	return JIT_ERR_NONE;
+}
+
+static double getNumber(void *x, t_symbol *s){
+	t_jit_headless_attr *attr = findAttr(x, s);
+	char *p;
+	if(!attr)return 0.;
+	p = (char*)x + attr->offset;
+	if(attr->type == _jit_sym_char)return *(uchar*)p;
+	if(attr->type == _jit_sym_long)return (double)*(long*)p;
+	if(attr->type == _jit_sym_float32)return *(float*)p;
+	if(attr->type == _jit_sym_float64)return *(double*)p;
+	return 0.;
+}
+
+t_jit_err jit_attr_setlong(void *x, t_symbol *s, t_atom_long c){
+	//Attributes of mop inputs/outputs only matter to the Max wrapper
+	if(x && (((t_object*)x)->o_kind == OBJECT_MOP_IO))return JIT_ERR_NONE;
+	return setNumber(x, s, (double)c);
+}
+
+t_jit_err jit_attr_setfloat(void *x, t_symbol *s, t_atom_float c){
+	return setNumber(x, s, c);
+}
+
+t_jit_err jit_attr_setsym(void *x, t_symbol *s, t_symbol *c){
+	t_jit_headless_attr *attr;
+	if(x && (((t_object*)x)->o_kind == OBJECT_MOP_IO))return JIT_ERR_NONE;
+	attr = findAttr(x, s);
+	if((!attr)||(attr->type != _jit_sym_symbol))return JIT_ERR_INVALID_INPUT;
+	*(t_symbol**)((char*)x + attr->offset) = c;
+	return JIT_ERR_NONE;
+}
+
+t_atom_long jit_attr_getlong(void *x, t_symbol *s){
+	return (t_atom_long)getNumber(x, s);
+}
+
+t_atom_float jit_attr_getfloat(void *x, t_symbol *s){
+	return getNumber(x, s);
+}
+
+//Only long arrays are needed so far
+t_jit_err jit_attr_setlong_array(void *x, t_symbol *s, long count, t_atom_long *vals){
+	t_jit_headless_attr *attr = findAttr(x, s);
+	long i, *p;
+	if((!attr)||(attr->type != _jit_sym_long)||(!vals))return JIT_ERR_INVALID_INPUT;
+	if(count > attr->size)count = attr->size;
+	p = (long*)((char*)x + attr->offset);
+	for(i=0;i<count;i++)p[i] = (long)clipValue(attr, (double)vals[i]);
+	if(attr->countOffset)*(long*)((char*)x + attr->countOffset) = count;
+	return JIT_ERR_NONE;
+}
+
+long jit_attr_getlong_array(void *x, t_symbol *s, long max, t_atom_long *vals){
+	t_jit_headless_attr *attr = findAttr(x, s);
+	long i, count, *p;
+	if((!attr)||(attr->type != _jit_sym_long)||(!vals))return 0;
+	count = attr->countOffset ? *(long*)((char*)x + attr->countOffset) : attr->size;
+	if(count > max)count = max;
+	p = (long*)((char*)x + attr->offset);
+	for(i=0;i<count;i++)vals[i] = p[i];
+	return count;
+}
+
+t_atom_long jit_atom_getlong(t_atom *a){
+	if(!a)return 0;
+	if(a->a_type == A_LONG)return a->a_w.w_long;
+	if(a->a_type == A_FLOAT)return (t_atom_long)a->a_w.w_float;
+	return 0;
+}
+
+
+/*******************************Matrix operators*********************************/
+
+t_jit_err jit_mop_single_type(void *x, t_symbol *s){
+	return x ? JIT_ERR_NONE : JIT_ERR_INVALID_PTR;
+}
+
+t_jit_err jit_mop_single_planecount(void *x, long c){
+	return x ? JIT_ERR_NONE : JIT_ERR_INVALID_PTR;
+}
+
+t_jit_err jit_mop_output_nolink(void *x, long index){
+	return x ? JIT_ERR_NONE : JIT_ERR_INVALID_PTR;
+}
@@ -30,6 +30,9 @@ extern "C" {
 } //extern "C"
 #endif
 
+#include "FlowStats.h"
+#include "LatencyAtoms.h"
+
 typedef struct _max_cv_jit_flow 
 {
 	t_object		ob;
@@ -40,6 +43,8 @@ t_jit_err cv_jit_flow_init(void);
 
 void *max_cv_jit_flow_new(t_symbol *s, long argc, t_atom *argv);
 void max_cv_jit_flow_free(t_max_cv_jit_flow *x);
+void max_cv_jit_flow_getstats(t_max_cv_jit_flow *x);
+void max_cv_jit_flow_getlatency(t_max_cv_jit_flow *x);
 
 void *max_cv_jit_flow_class;
 		 	
@@ -66,6 +71,8 @@ void ext_main(void *r)
     max_jit_classex_standard_wrap(p,q,0); 	
 
     addmess((method)max_jit_mop_assist, "assist", A_CANT,0);	//Add outlet assistance to object
+    addmess((method)max_cv_jit_flow_getstats, "getstats", 0);	//Stage timings out the dump outlet
+    addmess((method)max_cv_jit_flow_getlatency, "getlatency", 0);	//Frame time percentiles out the dump outlet
 }
 
 void max_cv_jit_flow_free(t_max_cv_jit_flow *x)
@@ -75,6 +82,53 @@ void max_cv_jit_flow_free(t_max_cv_jit_flow *x)
 	max_jit_obex_free(x);		//Free the Max wrapper object
 }
 
+static void max_cv_jit_flow_dumpstats(t_max_cv_jit_flow *x, FlowStats *stats)
+{
+	t_atom a[4];
+	int i;
+	
+	for(i=0;i<stats->stageCount;i++){
+		atom_setsym(a, gensym((char *)stats->names[i]));
+		atom_setfloat(a+1, stats->last[i]);
+		atom_setfloat(a+2, stats->getMean(i));
+		atom_setfloat(a+3, stats->max[i]);
+		max_jit_obex_dumpout(x, gensym("stage"), 4, a);
+	}
+}
+
+//Outputs "stage <name> <last> <mean> <max>" per stage, in milliseconds,
+//then "features <features> <vectors> <good vectors>" and "frames <n>"
+void max_cv_jit_flow_getstats(t_max_cv_jit_flow *x)
+{
+	FlowStats tracker, wrapper;
+	t_atom a[3];
+	
+	jit_object_method(max_jit_obex_jitob_get(x), gensym("getstats"), &tracker, &wrapper);
+	max_cv_jit_flow_dumpstats(x, &tracker);
+	max_cv_jit_flow_dumpstats(x, &wrapper);
+	
+	atom_setlong(a, tracker.features);
+	atom_setlong(a+1, tracker.vectors);
+	atom_setlong(a+2, tracker.goodVectors);
+	max_jit_obex_dumpout(x, gensym("features"), 3, a);
+	atom_setlong(a, tracker.frames);
+	max_jit_obex_dumpout(x, gensym("frames"), 1, a);
+}
+
+//Outputs "latency <name> <frames> <p50> <p95> <p99> <max> <mean>", in
+//milliseconds, for processFrame and matrix_calc. "resetstats" clears them.
+void max_cv_jit_flow_getlatency(t_max_cv_jit_flow *x)
+{
+	FlowStats tracker, wrapper;
+	t_atom a[LATENCY_ATOM_COUNT];
+	
+	jit_object_method(max_jit_obex_jitob_get(x), gensym("getstats"), &tracker, &wrapper);
+	latencyToAtoms("processFrame", &tracker.latency, a);
+	max_jit_obex_dumpout(x, gensym("latency"), LATENCY_ATOM_COUNT, a);
+	latencyToAtoms("matrix_calc", &wrapper.latency, a);
+	max_jit_obex_dumpout(x, gensym("latency"), LATENCY_ATOM_COUNT, a);
+}
+
 void *max_cv_jit_flow_new(t_symbol *s, long argc, t_atom *argv)
 {
 	t_max_cv_jit_flow *x;
@@ -21,6 +21,8 @@
 #include "jit.common.h"
 #include "max.jit.mop.h"
 
+#include "LatencyAtoms.h"
+
 typedef struct _max_cv_jit_flowfield 
 {
 	t_object		ob;
@@ -31,6 +33,7 @@ t_jit_err cv_jit_flowfield_init(void);
 
 void *max_cv_jit_flowfield_new(t_symbol *s, long argc, t_atom *argv);
 void max_cv_jit_flowfield_free(t_max_cv_jit_flowfield *x);
+void max_cv_jit_flowfield_getlatency(t_max_cv_jit_flowfield *x);
 
 void *max_cv_jit_flowfield_class;
 		 	
@@ -54,6 +57,7 @@ int main(void)
     max_jit_classex_standard_wrap(p,q,0); 	
 
     addmess((method)max_jit_mop_assist, "assist", A_CANT,0);	//Add outlet assistance to object
+    addmess((method)max_cv_jit_flowfield_getlatency, "getlatency", 0);	//Frame time percentiles out the dump outlet
     
     return 0;
 }
@@ -65,6 +69,20 @@ void max_cv_jit_flowfield_free(t_max_cv_jit_flowfield *x)
 	max_jit_obex_free(x);		//Free the Max wrapper object
 }
 
+//Outputs "latency <name> <frames> <p50> <p95> <p99> <max> <mean>", in
+//milliseconds, for processFrame and matrix_calc. "resetstats" clears them.
+void max_cv_jit_flowfield_getlatency(t_max_cv_jit_flowfield *x)
+{
+	LatencyHistogram field, wrapper;
+	t_atom a[LATENCY_ATOM_COUNT];
+	
+	jit_object_method(max_jit_obex_jitob_get(x), gensym("getlatency"), &field, &wrapper);
+	latencyToAtoms("processFrame", &field, a);
+	max_jit_obex_dumpout(x, gensym("latency"), LATENCY_ATOM_COUNT, a);
+	latencyToAtoms("matrix_calc", &wrapper, a);
+	max_jit_obex_dumpout(x, gensym("latency"), LATENCY_ATOM_COUNT, a);
+}
+
 void *max_cv_jit_flowfield_new(t_symbol *s, long argc, t_atom *argv)
 {
 	t_max_cv_jit_flowfield *x;
@@ -0,0 +1,314 @@
+/*
+	allocations.cpp
+
+	Checks that the tracking core does not touch the heap once it has warmed
+	up. malloc and friends are interposed, so every allocation is seen,
+	whether it comes from a growArray, a cv::Mat, a std::vector or operator
+	new, and whether or not the component counts it. Each allocation made
+	during the measured frames is attributed from its backtrace: the first
+	frame in this executable is the call site in the tracker. Allocations
+	made inside OpenCV count against the tracker too, unless the OpenCV
+	function that the tracker called is one that is known to allocate
+	internally on every call (see openCVAllocates). Allocations that never
+	reach this executable, such as OpenCV's own thread pool, are ignored.
+
+	Needs OpenCV as shared libraries, exits with 77 (skipped) otherwise.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <malloc.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <cxxabi.h>
+#include <atomic>
+
+#include "opencv.hpp"
+#include "OpticalFlowTracker.h"
+#include "AsyncTracker.h"
+#include "FlowField.h"
+#include "FrameSource.h"
+
+#define WARMUP_FRAMES 200
+#define MEASURED_FRAMES 100
+#define MAX_DEPTH 64
+#define MAX_SITES 64
+
+extern "C" {
+	void* __libc_malloc(size_t size);
+	void* __libc_calloc(size_t n, size_t size);
+	void* __libc_realloc(void *p, size_t size);
+	void* __libc_memalign(size_t alignment, size_t size);
+	void __libc_free(void *p);
+}
+
+/****Attribution****/
+
+typedef struct _site
+{
+	void			*address;	//first frame in this executable
+	void			*callee;	//OpenCV function called from there, if any
+	unsigned int	count;
+} t_site;
+
+static std::atomic<bool> counting(false);
+static std::atomic_flag sitesLock = ATOMIC_FLAG_INIT;
+static thread_local int inHook = 0;
+static t_site sites[MAX_SITES];
+static int siteCount = 0;
+static unsigned int ours = 0;
+static unsigned int external = 0;
+static void *selfBase = 0;
+
+/*OpenCV functions that allocate scratch memory internally on every call,
+  matched against the outermost OpenCV frame (mangled or C names).*/
+static const char *openCVAllocates[] = {
+	"GoodFeaturesToTrack",
+	"goodFeaturesToTrack",
+	"CalcOpticalFlowPyrLK",
+	"calcOpticalFlowPyrLK",
+	"buildOpticalFlowPyramid",
+	"phaseCorrelate",
+	"parallel_for_",
+	0
+};
+
+static int isOpenCV(const Dl_info &info){
+	return info.dli_fname && strstr(info.dli_fname, "opencv");
+}
+
+static int isAllowed(const char *name){
+	int i;
+	if(!name)return 0;
+	for(i=0;openCVAllocates[i];i++)if(strstr(name, openCVAllocates[i]))return 1;
+	return 0;
+}
+
+static void addSite(void *address, void *callee){
+	int i;
+	while(sitesLock.test_and_set(std::memory_order_acquire));
+	ours++;
+	for(i=0;i<siteCount;i++)if((sites[i].address == address) && (sites[i].callee == callee))break;
+	if(i < siteCount)sites[i].count++;
+	else if(siteCount < MAX_SITES){
+		sites[siteCount].address = address;
+		sites[siteCount].callee = callee;
+		sites[siteCount].count = 1;
+		siteCount++;
+	}
+	sitesLock.clear(std::memory_order_release);
+}
+
+//caller is the return address of the interposed function
+static void record(void *caller){
+	void *frames[MAX_DEPTH];
+	void *callee = 0;
+	const char *calleeName = 0;
+	Dl_info info;
+	int i, n;
+
+	n = backtrace(frames, MAX_DEPTH);
+	for(i=0;(i<n)&&(frames[i]!=caller);i++);
+	for(;i<n;i++){
+		if(!dladdr(frames[i], &info))continue;
+		if(info.dli_fbase == selfBase){
+			if(callee && isAllowed(calleeName))break;
+			addSite(frames[i], callee);
+			return;
+		}
+		if(isOpenCV(info)){
+			callee = info.dli_saddr;
+			calleeName = info.dli_sname;
+		}
+	}
+	while(sitesLock.test_and_set(std::memory_order_acquire));
+	external++;
+	sitesLock.clear(std::memory_order_release);
+}
+
+#define RECORD() if(counting.load(std::memory_order_relaxed) && !inHook){inHook = 1; record(__builtin_return_address(0)); inHook = 0;}
+
+/****Interposition****/
+
+extern "C" {
+
+void* malloc(size_t size){
+	RECORD();
+	return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size){
+	RECORD();
+	return __libc_calloc(n, size);
+}
+
+void* realloc(void *p, size_t size){
+	RECORD();
+	return __libc_realloc(p, size);
+}
+
+void free(void *p){
+	__libc_free(p);
+}
+
+void* memalign(size_t alignment, size_t size){
+	RECORD();
+	return __libc_memalign(alignment, size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size){
+	RECORD();
+	return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **p, size_t alignment, size_t size){
+	RECORD();
+	*p = __libc_memalign(alignment, size);
+	return *p ? 0 : ENOMEM;
+}
+
+}
+
+/****Report****/
+
+static void printSymbol(void *address){
+	Dl_info info;
+	int status = -1;
+	char *name = 0;
+	if(!dladdr(address, &info) || !info.dli_sname){printf("%p", address); return;}
+	name = abi::__cxa_demangle(info.dli_sname, 0, 0, &status);
+	printf("%s+0x%lx", status ? info.dli_sname : name, (unsigned long)((char*)address - (char*)info.dli_saddr));
+	free(name);
+}
+
+static int report(const char *config){
+	int i;
+	printf("%-32s %u allocations in the tracker, %u in OpenCV\n", config, ours, external);
+	for(i=0;i<siteCount;i++){
+		printf("    %u x ", sites[i].count);
+		printSymbol(sites[i].address);
+		if(sites[i].callee){
+			printf(" -> ");
+			printSymbol(sites[i].callee);
+		}
+		printf("\n");
+	}
+	return ours == 0;
+}
+
+static void startCounting(){
+	ours = 0;
+	external = 0;
+	siteCount = 0;
+	counting = true;
+}
+
+/****Configurations****/
+
+static void defaultSettings(FlowSettings &s){
+	s.threshold = 0.01f;
+	s.minDistance = 0.01f;
+	s.radius = 7;
+	s.detector = FEATURE_ALGO_EIGENVALS;
+	s.occupancy = false;
+	s.interval = 1;
+	s.threads = 0;
+	s.tileCols = 1;
+	s.tileRows = 1;
+	s.predict = false;
+	s.globalMotion = false;
+	s.fbCheck = false;
+	s.fbThreshold = 1.f;
+	s.asyncDetection = false;
+	s.budget = 0.f;
+	s.telemetry = false;
+	s.planes = 7;
+}
+
+static int checkTracker(const char *config, const FlowSettings &settings){
+	OpticalFlowTracker tracker;
+	FlowResult result;
+	FrameSource source(320, 240, 1);
+	int i;
+
+	settings.apply(tracker);
+	for(i=0;i<WARMUP_FRAMES+MEASURED_FRAMES;i++){
+		CvMat image = source.next();
+		if(i == WARMUP_FRAMES)startCounting();
+		if(!tracker.processFrame(&image) || !result.pack(tracker, settings.planes)){
+			counting = false;
+			printf("%s: frame %d: %s\n", config, i, tracker.getErrorMess());
+			return 0;
+		}
+	}
+	counting = false;
+	return report(config);
+}
+
+static int checkFlowField(const char *config, int mode, int dilation, bool globalMotion){
+	FlowField field;
+	FrameSource source(320, 240, 1);
+	int i;
+
+	field.setMode(mode);
+	field.setDilation(dilation);
+	field.setGlobalMotion(globalMotion);
+	for(i=0;i<WARMUP_FRAMES+MEASURED_FRAMES;i++){
+		CvMat image = source.next();
+		if(i == WARMUP_FRAMES)startCounting();
+		if(!field.processFrame(&image)){
+			counting = false;
+			printf("%s: frame %d: %s\n", config, i, field.getErrorMess());
+			return 0;
+		}
+	}
+	counting = false;
+	return report(config);
+}
+
+static void anchor(){}
+
+int main(){
+	FlowSettings s;
+	Dl_info info;
+	void *frames[4];
+	int ok = 1;
+
+	if(!dladdr((void*)&anchor, &info)){printf("dladdr failed\n"); return 1;}
+	selfBase = info.dli_fbase;
+	if(!dladdr((void*)&cvGetTickFrequency, &info) || (info.dli_fbase == selfBase)){
+		printf("OpenCV is linked statically, allocations cannot be attributed\n");
+		return 77;
+	}
+	//The first backtrace() loads libgcc
+	backtrace(frames, 4);
+
+	defaultSettings(s);
+	ok &= checkTracker("eigenvalues", s);
+	s.tileCols = 3; s.tileRows = 2; s.occupancy = true;
+	ok &= checkTracker("eigenvalues, tiles, occupancy", s);
+	defaultSettings(s);
+	s.detector = FEATURE_ALGO_FAST;
+	ok &= checkTracker("FAST", s);
+	defaultSettings(s);
+	s.predict = true; s.globalMotion = true; s.threads = 2;
+	ok &= checkTracker("predict, global motion, threads", s);
+	defaultSettings(s);
+	s.fbCheck = true; s.interval = 3; s.planes = 8;
+	ok &= checkTracker("forward-backward, interval", s);
+	defaultSettings(s);
+	s.asyncDetection = true;
+	ok &= checkTracker("async detection", s);
+
+	ok &= checkFlowField("flowfield mode 0", 0, 0, false);
+	ok &= checkFlowField("flowfield mode 1, dilate", 1, 2, false);
+	ok &= checkFlowField("flowfield global motion", 1, 0, true);
+
+	if(!ok){
+		printf("FAILED: the tracker allocated after warm-up\n");
+		return 1;
+	}
+	return 0;
+}
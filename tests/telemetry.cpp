@@ -0,0 +1,105 @@
+/*
+	telemetry.cpp
+
+	The telemetry segment is a seqlock: the writer never waits, readers
+	retry until they get a copy the writer did not touch halfway. A writer
+	thread publishes stats whose fields all hold the same frame number while
+	the main thread reads as fast as it can; any copy whose fields disagree,
+	or whose frame number goes backwards, is torn. Then a tracker processes
+	two frames, which publishes the second, and turning its telemetry off
+	must remove the segment at once.
+*/
+
+#include <stdio.h>
+#include <thread>
+#include <atomic>
+
+#include "opencv.hpp"
+#include "Telemetry.h"
+#include "OpticalFlowTracker.h"
+
+#define PUBLISH_COUNT 200000
+
+static const char *const stageNames[] = {"stage"};
+
+static void writer(TelemetryPublisher *publisher, std::atomic<bool> *finished){
+	FlowStats stats;
+	unsigned int k;
+
+	stats.setStages(stageNames, 1);
+	for(k=1;k<=PUBLISH_COUNT;k++){
+		stats.frames = k;
+		stats.features = k;
+		stats.vectors = k;
+		stats.goodVectors = k;
+		stats.last[0] = (double)k;
+		stats.sum[0] = (double)k;
+		stats.samples[0] = 1;
+		stats.max[0] = (double)k;
+		publisher->publish(stats);
+	}
+	finished->store(true);
+}
+
+static int stress(){
+	TelemetryPublisher publisher;
+	TelemetryReader reader;
+	TelemetryData d;
+	std::atomic<bool> finished(false);
+	unsigned int reads = 0, busy = 0, torn = 0, last = 0;
+
+	if(!publisher.open(1)){printf("%s\n", publisher.getErrorMess()); return 0;}
+	if(!reader.open(publisher.getName())){printf("%s\n", reader.getErrorMess()); return 0;}
+
+	std::thread t(writer, &publisher, &finished);
+	while(!finished.load()){
+		if(!reader.read(d)){busy++; continue;}
+		reads++;
+		if((d.features != d.frames)||(d.vectors != d.frames)||(d.goodVectors != d.frames)||(d.stageCount != 1)
+			||(d.stages[0].last != (double)d.frames)||(d.stages[0].mean != (double)d.frames)||(d.stages[0].max != (double)d.frames)
+			||(d.frames < last))torn++;
+		last = d.frames;
+	}
+	t.join();
+
+	printf("seqlock: %u reads, %u busy, %u torn\n", reads, busy, torn);
+	if(torn){printf("FAILED: torn reads\n"); return 0;}
+	if(!reads){printf("FAILED: no reads\n"); return 0;}
+	if((!reader.read(d))||(d.frames != PUBLISH_COUNT)){printf("FAILED: last frame not published\n"); return 0;}
+	return 1;
+}
+
+static int closeSegment(){
+	OpticalFlowTracker tracker;
+	TelemetryReader reader;
+	TelemetryData d;
+	cv::Mat noise(240, 320, CV_8UC1);
+	cv::RNG rng(1);
+	char name[64];
+
+	rng.fill(noise, cv::RNG::UNIFORM, 0, 256);
+	CvMat image = noise;
+
+	//The first frame only starts the tracks and is not published or counted
+	tracker.setTelemetry(true);
+	for(int i=0;i<2;i++){
+		if(!tracker.processFrame(&image)){printf("%s\n", tracker.getErrorMess()); return 0;}
+	}
+	strcpy_s(name, 63, tracker.getTelemetryName());
+	if(!reader.open(name)){printf("%s\n", reader.getErrorMess()); return 0;}
+	if((!reader.read(d))||(d.frames != 1)){printf("FAILED: frame not published\n"); return 0;}
+	reader.close();
+
+	tracker.setTelemetry(false);
+	if(reader.open(name)){printf("FAILED: %s still open after turning telemetry off\n", name); return 0;}
+	printf("close: %s removed\n", name);
+	return 1;
+}
+
+int main(){
+	int ok = 1;
+	ok = ok && stress();
+	ok = ok && closeSegment();
+	if(!ok)return 1;
+	return 0;
+}
@@ -0,0 +1,80 @@
+/*
+	tiles.cpp
+
+	Tiled Shi-Tomasi detection with changing layouts. Each tile writes up to
+	maxCount / tiles points into its own slice of a shared buffer, so going
+	from more tiles to fewer, or to a single masked tile, raises the quota
+	and the buffer must grow with it. The time budget also moves maxCount
+	up and down from frame to frame, which changes the quota the same way.
+	The frame is dense noise with a low threshold and no minimum distance,
+	so that every tile fills its quota.
+	Best run with -DCVFLOW_ASAN=ON, which reports any write past the buffer.
+*/
+
+#include <stdio.h>
+
+#include "opencv.hpp"
+#include "FeatureDetector.h"
+
+#define WIDTH 640
+#define HEIGHT 480
+
+static int detect(FeatureDetector &detector, CvMat *image, int cols, int rows, bool masked){
+	CvPoint2D32f occupied = cvPoint2D32f(WIDTH / 2, HEIGHT / 2);
+	unsigned int i, n;
+
+	detector.setTiles(cols, rows);
+	if(masked)detector.setOccupied(&occupied, 0, 1, 4.f);
+	if(!detector.findFeatures(image)){
+		printf("%dx%d%s: %s\n", cols, rows, masked ? " masked" : "", detector.getErrorMess());
+		return 0;
+	}
+	n = detector.getCount();
+	printf("%dx%d%s: %u features, maxCount %u\n", cols, rows, masked ? " masked" : "", n, detector.getMaxCount());
+	if(n > detector.getMaxCount()){printf("FAILED: more features than maxCount\n"); return 0;}
+	if(n == 0){printf("FAILED: no features\n"); return 0;}
+	const CvPoint2D32f *f = detector.getFeaturePtr();
+	for(i=0;i<n;i++){
+		if((f[i].x < 0.f) || (f[i].y < 0.f) || (f[i].x >= WIDTH) || (f[i].y >= HEIGHT)){
+			printf("FAILED: feature %u at %f, %f is outside the frame\n", i, f[i].x, f[i].y);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+int main(){
+	FeatureDetector detector;
+	cv::Mat noise(HEIGHT, WIDTH, CV_8UC1);
+	cv::RNG rng(1);
+	int ok = 1;
+
+	rng.fill(noise, cv::RNG::UNIFORM, 0, 256);
+	CvMat image = noise;
+
+	detector.setAlgorithm(FEATURE_ALGO_EIGENVALS);
+	detector.setThreshold(0.001f);
+	detector.setMinDistance(0.f);
+	detector.setUseOccupancy(true);
+	detector.setMaxCount(MAX_EIG_FEATURE_COUNT);
+
+	//Fewer tiles after more: the per-tile quota rises
+	ok = ok && detect(detector, &image, 3, 1, false);
+	ok = ok && detect(detector, &image, 2, 1, false);
+	ok = ok && detect(detector, &image, 1, 1, true);
+	ok = ok && detect(detector, &image, 5, 3, false);
+	ok = ok && detect(detector, &image, 2, 2, true);
+
+	//maxCount as the budget moves it, down to a handful and back up
+	static const unsigned int counts[] = {32, 2048, 700, 1, 1500, 2048};
+	unsigned int i;
+	for(i=0;i<sizeof(counts)/sizeof(counts[0]);i++){
+		detector.setMaxCount(counts[i]);
+		ok = ok && detect(detector, &image, 3, 1, false);
+		ok = ok && detect(detector, &image, 1, 1, true);
+		ok = ok && detect(detector, &image, 4, 4, true);
+	}
+
+	if(!ok)return 1;
+	return 0;
+}